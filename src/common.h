@@ -2,7 +2,9 @@
 #define COMMON_H
 
 #define VERSION_NUM "0.5.1"
-#define ALGORITHM_VER 2
+#define ALGORITHM_VER 5
+// the oldest data format that can still be decoded
+#define MIN_ALGORITHM_VER 2
 
 #define _DEBUG false
 
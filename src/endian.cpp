@@ -18,6 +18,12 @@ uint32 swapEndianess(uint32 num) {
     return ((num>>24)&0xff) | ((num<<8)&0xff0000) |  ((num>>8)&0xff00) | ((num<<24)&0xff000000); 
 }
 
+uint64 swapEndianess(uint64 num) {
+    uint64 high = swapEndianess((uint32)(num & 0xffffffff));
+    uint64 low = swapEndianess((uint32)(num >> 32));
+    return (high << 32) | low;
+}
+
 uint16 adaptToLittleEndian(uint16 num) {
     if(isLittleEndian())
         return num;
@@ -32,6 +38,13 @@ uint32 adaptToLittleEndian(uint32 num) {
         return swapEndianess(num);
 }
 
+uint64 adaptToLittleEndian(uint64 num) {
+    if(isLittleEndian())
+        return num;
+    else
+        return swapEndianess(num);
+}
+
 uint16 adaptToBigEndian(uint16 num) {
     if(!isLittleEndian())
         return num;
@@ -56,6 +69,11 @@ void writeLittleEndian(ostream& ofs, uint32 num) {
     ofs.write((char*)&data, sizeof(uint32));
 }
 
+void writeLittleEndian(ostream& ofs, uint64 num) {
+    uint64 data = adaptToLittleEndian(num);
+    ofs.write((char*)&data, sizeof(uint64));
+}
+
 void writeBigEndian(ostream& ofs, uint16 num) {
     uint16 data = adaptToBigEndian(num);
     ofs.write((char*)&data, sizeof(uint16));
@@ -78,6 +96,12 @@ uint32 readLittleEndian32(istream& ifs) {
     return adaptToLittleEndian(data);
 }
 
+uint64 readLittleEndian64(istream& ifs) {
+    uint64 data=0;
+    ifs.read((char*)&data, sizeof(uint64));
+    return adaptToLittleEndian(data);
+}
+
 uint16 readBigEndian16(istream& ifs) {
     uint16 data=0;
     ifs.read((char*)&data, sizeof(uint16));
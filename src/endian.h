@@ -11,16 +11,20 @@ using namespace std;
 bool isLittleEndian();
 uint16 swapEndianess(uint16 num);
 uint32 swapEndianess(uint32 num);
+uint64 swapEndianess(uint64 num);
 uint16 adaptToLittleEndian(uint16 num);
 uint32 adaptToLittleEndian(uint32 num);
+uint64 adaptToLittleEndian(uint64 num);
 uint16 adaptToBigEndian(uint16 num);
 uint32 adaptToBigEndian(uint32 num);
 void writeLittleEndian(ostream& ofs, uint16 num);
 void writeLittleEndian(ostream& ofs, uint32 num);
+void writeLittleEndian(ostream& ofs, uint64 num);
 void writeBigEndian(ostream& ofs, uint16 num);
 void writeBigEndian(ostream& ofs, uint32 num);
 uint16 readLittleEndian16(istream& ifs);
 uint32 readLittleEndian32(istream& ifs);
+uint64 readLittleEndian64(istream& ifs);
 uint16 readBigEndian16(istream& ifs);
 uint32 readBigEndian32(istream& ifs);
 #endif
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "fastqmeta.h"
 #include <iostream>
+#include <limits.h>
 
 FastqMeta::FastqMeta(){
     lane = 0;
@@ -19,7 +20,33 @@ void FastqMeta::print() {
 //illumina sequence name line format
 //@<instrument>:<run number>:<flowcell ID>:<lane>:<tile_no>:<x-pos>:<y-pos> <read>:<is filtered>:<control number>:<index sequence>
 
-FastqMeta FastqMeta::parse(string str) {
+// the same as atoi(), but the number is in [start, end)
+static int parseInt(const char* start, const char* end) {
+    const char* p = start;
+    while(p < end && (*p == ' ' || (*p >= '\t' && *p <= '\r')))
+        p++;
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    long val = 0;
+    bool overflow = false;
+    while(p < end && *p >= '0' && *p <= '9') {
+        int digit = *p - '0';
+        if(val > (LONG_MAX - digit) / 10)
+            overflow = true;
+        else
+            val = val * 10 + digit;
+        p++;
+    }
+    // saturate like strtol() does
+    if(overflow)
+        return (int)(negative ? LONG_MIN : LONG_MAX);
+    return (int)(negative ? -val : val);
+}
+
+void FastqMeta::parse(const char* str, int len, FastqNameFields& fields) {
     int colon = 0;
     int lastColonPos = 0;
     int coordsStartAt = 0;
@@ -29,31 +56,30 @@ FastqMeta FastqMeta::parse(string str) {
     uint32 x = 0;
     uint32 y = 0;
 
-    for(int i=0; i<str.length(); i++) {
+    for(int i=0; i<len; i++) {
         char c = str[i];
+        if(c != ':' && c != ' ')
+            continue;
         if(c == ':') {
             colon++;
         }
-        if(c == ':' || c==' ') {
-            if(colon >= 4 && colon<=7) {
-                string item = str.substr(lastColonPos+1, i-lastColonPos-1);
-                int val = atoi(item.c_str());
-                switch(colon) {
-                    case 4: 
-                        lane = val;
-                        coordsStartAt = lastColonPos + 1;
-                        break;
-                    case 5: tile = val; break;
-                    case 6: 
-                        if(c == ':')
-                            x = val;
-                        break;
-                    case 7: y = val; break;
-                    default: break;
-                }
-                if(c==' ' && colon == 6)
-                    y = val;
+        if(colon >= 4 && colon<=7) {
+            int val = parseInt(str + lastColonPos + 1, str + i);
+            switch(colon) {
+                case 4: 
+                    lane = val;
+                    coordsStartAt = lastColonPos + 1;
+                    break;
+                case 5: tile = val; break;
+                case 6: 
+                    if(c == ':')
+                        x = val;
+                    break;
+                case 7: y = val; break;
+                default: break;
             }
+            if(c==' ' && colon == 6)
+                y = val;
         }
         if(c == ':') {
             lastColonPos = i;
@@ -64,18 +90,39 @@ FastqMeta FastqMeta::parse(string str) {
         }
     }
 
-    FastqMeta ret;
     if(coordsStartAt>0 && coordsEndAt>0) {
-        ret.lane = lane;
-        ret.tile = tile;
-        ret.x = x;
-        ret.y = y;
-        ret.hasLaneTileXY = true;
-        ret.namePart1 = str.substr(0, coordsStartAt - 1);
-        ret.namePart2 = str.substr(coordsEndAt, str.length() - coordsEndAt);
+        fields.lane = lane;
+        fields.tile = tile;
+        fields.x = x;
+        fields.y = y;
+        fields.hasLaneTileXY = true;
+        fields.name1Len = coordsStartAt - 1;
+        fields.name2Start = coordsEndAt;
+        fields.name2Len = len - coordsEndAt;
     } else {
-        ret.namePart1 = str;
+        fields.lane = 0;
+        fields.tile = 0;
+        fields.x = 0;
+        fields.y = 0;
+        fields.hasLaneTileXY = false;
+        fields.name1Len = len;
+        fields.name2Start = len;
+        fields.name2Len = 0;
     }
+}
+
+FastqMeta FastqMeta::parse(string str) {
+    FastqNameFields fields;
+    parse(str.c_str(), str.length(), fields);
+
+    FastqMeta ret;
+    ret.lane = fields.lane;
+    ret.tile = fields.tile;
+    ret.x = fields.x;
+    ret.y = fields.y;
+    ret.hasLaneTileXY = fields.hasLaneTileXY;
+    ret.namePart1 = str.substr(0, fields.name1Len);
+    ret.namePart2 = str.substr(fields.name2Start, fields.name2Len);
     return ret;
 }
 
@@ -106,5 +153,13 @@ bool FastqMeta::test() {
         cerr << "namePart2 is wrong:" << meta.namePart2 << endl;
         return false;
     }
+
+    string name = "@SRR1234.1 1/1";
+    FastqNameFields fields;
+    parse(name.c_str(), name.length(), fields);
+    if(fields.hasLaneTileXY || fields.name1Len != name.length() || fields.name2Len != 0) {
+        cerr << "a name without lane/tile/x/y is parsed wrongly" << endl;
+        return false;
+    }
     return true;
 }
\ No newline at end of file
@@ -17,11 +17,25 @@ using namespace std;
 * <NAME2> =  1:N:0:ACTGTTCC
 */
 
+// the fields of a query name, located by offsets so that parsing needs no allocation
+// <NAME1> is name[0, name1Len), <NAME2> is name[name2Start, name2Start + name2Len)
+struct FastqNameFields{
+    int name1Len;
+    int name2Start;
+    int name2Len;
+    uint8 lane;
+    uint16 tile;
+    uint32 x;
+    uint32 y;
+    bool hasLaneTileXY;
+};
+
 class FastqMeta{
 public:
     FastqMeta();
     void print();
     static FastqMeta parse(string str);
+    static void parse(const char* name, int len, FastqNameFields& fields);
     static bool test();
 
 public:
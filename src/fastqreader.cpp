@@ -1,6 +1,8 @@
 #include "fastqreader.h"
 #include "util.h"
+#include "simd.h"
 #include <string.h>
+#include <unistd.h>
 
 #define FQ_BUF_SIZE (1<<20)
 
@@ -12,16 +14,19 @@ FastqReader::FastqReader(string filename, bool hasQuality, bool phred64){
 	mStdinMode = false;
 	mPhred64 = phred64;
 	mHasQuality = hasQuality;
-	mBuf = new char[FQ_BUF_SIZE];
+	// a block is always appended after the unconsumed tail of the buffer
+	mBufSize = FQ_BUF_SIZE * 2;
+	mBuf = new char[mBufSize];
 	mBufDataLen = 0;
 	mBufUsedLen = 0;
 	mHasNoLineBreakAtEnd = false;
+	mReachedEnd = false;
 	init();
 }
 
 FastqReader::~FastqReader(){
 	close();
-	delete mBuf;
+	delete[] mBuf;
 }
 
 bool FastqReader::hasNoLineBreakAtEnd() {
@@ -29,18 +34,39 @@ bool FastqReader::hasNoLineBreakAtEnd() {
 }
 
 void FastqReader::readToBuf() {
+	// keep the unconsumed tail, which is a record crossing the end of last block
+	int tail = mBufDataLen - mBufUsedLen;
+	if(tail > 0)
+		memmove(mBuf, mBuf + mBufUsedLen, tail);
+	else
+		tail = 0;
+
+	// a very long record doesn't fit in the buffer
+	if(tail + FQ_BUF_SIZE > mBufSize) {
+		int newSize = mBufSize * 2;
+		char* newBuf = new char[newSize];
+		memcpy(newBuf, mBuf, tail);
+		delete[] mBuf;
+		mBuf = newBuf;
+		mBufSize = newSize;
+	}
+
+	int readed = 0;
 	if(mZipped) {
-		mBufDataLen = gzread(mZipFile, mBuf, FQ_BUF_SIZE);
-		if(mBufDataLen == -1) {
+		readed = gzread(mZipFile, mBuf + tail, FQ_BUF_SIZE);
+		if(readed == -1) {
 			cerr << "Error to read gzip file" << endl;
+			readed = 0;
 		}
 	} else {
-		mBufDataLen = fread(mBuf, 1, FQ_BUF_SIZE, mFile);
+		readed = fread(mBuf + tail, 1, FQ_BUF_SIZE, mFile);
 	}
+	mBufDataLen = tail + readed;
 	mBufUsedLen = 0;
 
-	if(mBufDataLen < FQ_BUF_SIZE) {
-		if(mBuf[mBufDataLen-1] != '\n')
+	if(readed < FQ_BUF_SIZE) {
+		mReachedEnd = true;
+		if(mBufDataLen > 0 && mBuf[mBufDataLen-1] != '\n')
 			mHasNoLineBreakAtEnd = true;
 	}
 }
@@ -91,68 +117,36 @@ void FastqReader::clearLineBreaks(char* line) {
 	}
 }
 
-string FastqReader::getLine(){
-	int copied = 0;
-
-	int start = mBufUsedLen;
-	int end = start;
+// find the line starting at pos, and move pos to the next line
+// return false if this line is not completely in the buffer, then the buffer needs to be refilled
+bool FastqReader::getLine(int& pos, const char*& line, int& len){
+	const char* start = mBuf + pos;
+	const char* dataEnd = mBuf + mBufDataLen;
+	const char* end = findLineBreak(start, dataEnd);
 
-	while(end < mBufDataLen) {
-		if(mBuf[end] != '\r' && mBuf[end] != '\n')
-			end++;
-		else
-			break;
+	if(end == dataEnd) {
+		// the last line without a line break
+		if(!mReachedEnd)
+			return false;
+		line = start;
+		len = end - start;
+		pos = mBufDataLen;
+		return true;
 	}
 
-	// this line well contained in this buf, or this is the last buf
-	if(end < mBufDataLen || mBufDataLen < FQ_BUF_SIZE) {
-		int len = end - start;
-		string line(mBuf+start, len);
+	// cannot tell \r from \r\n yet
+	if(*end == '\r' && end + 1 == dataEnd && !mReachedEnd)
+		return false;
 
-		// skip \n or \r
+	line = start;
+	len = end - start;
+	// skip \n or \r
+	end++;
+	// handle \r\n
+	if(end < dataEnd && end[-1] == '\r' && *end == '\n')
 		end++;
-		// handle \r\n
-		if(end < mBufDataLen-1 && mBuf[end] == '\n')
-			end++;
-
-		mBufUsedLen = end;
-
-		return line;
-	}
-
-	// this line is not contained in this buf, we need to read new buf
-	string str(mBuf+start, mBufDataLen - start);
-
-	while(true) {
-		readToBuf();
-		start = 0;
-		end = 0;
-		while(end < mBufDataLen) {
-			if(mBuf[end] != '\r' && mBuf[end] != '\n')
-				end++;
-			else
-				break;
-		}
-		// this line well contained in this buf, we need to read new buf
-		if(end < mBufDataLen || mBufDataLen < FQ_BUF_SIZE) {
-			int len = end - start;
-			str.append(mBuf+start, len);
-
-			// skip \n or \r
-			end++;
-			// handle \r\n
-			if(end < mBufDataLen-1 && mBuf[end] == '\n')
-				end++;
-
-			mBufUsedLen = end;
-
-			return str;
-		}
-		// even this new buf is not enough, although impossible
-		str.append(mBuf+start, mBufDataLen);
-	}
-
-	return string();
+	pos = end - mBuf;
+	return true;
 }
 
 bool FastqReader::eof() {
@@ -163,32 +157,61 @@ bool FastqReader::eof() {
 	}
 }
 
-Read* FastqReader::read(){
+bool FastqReader::readRecord(FastqRecord& rec){
 	if (mZipped){
 		if (mZipFile == NULL)
-			return NULL;
+			return false;
 	}
 
-	if(mBufUsedLen >= mBufDataLen && eof()) {
-		return NULL;
+	while(true) {
+		if(mBufUsedLen >= mBufDataLen && mReachedEnd)
+			return false;
+
+		int pos = mBufUsedLen;
+		bool complete = getLine(pos, rec.name, rec.nameLen)
+			&& getLine(pos, rec.seq, rec.seqLen)
+			&& getLine(pos, rec.strand, rec.strandLen);
+		if(complete) {
+			if(mHasQuality) {
+				complete = getLine(pos, rec.qual, rec.qualLen);
+			} else {
+				rec.qual = NULL;
+				rec.qualLen = 0;
+			}
+		}
+
+		if(complete) {
+			mBufUsedLen = pos;
+			if(rec.nameLen == 0 || rec.seqLen == 0 || rec.strandLen == 0)
+				return false;
+			if(mHasQuality && rec.qualLen == 0)
+				return false;
+			return true;
+		}
+
+		// this record crosses the end of the buffer, only its head is copied in refilling
+		readToBuf();
 	}
 
-	string name = getLine();
-	string sequence = getLine();
-	string strand = getLine();
+	return false;
+}
 
-	if(name.empty() || sequence.empty() || strand.empty())
+Read* FastqReader::read(){
+	FastqRecord rec;
+	if(!readRecord(rec))
 		return NULL;
 
+	string name(rec.name, rec.nameLen);
+	string sequence(rec.seq, rec.seqLen);
+	string strand(rec.strand, rec.strandLen);
+
 	// WAR for FQ with no quality
 	if (!mHasQuality){
 		string quality = string(sequence.length(), 'K');
 		return new Read(name, sequence, strand, quality, mPhred64);
 	}
 	else {
-		string quality = getLine();
-		if(quality.empty())
-			return NULL;
+		string quality(rec.qual, rec.qualLen);
 		return new Read(name, sequence, strand, quality, mPhred64);
 	}
 
@@ -240,23 +263,85 @@ bool FastqReader::isZipped(){
 	return mZipped;
 }
 
-bool FastqReader::test(){
-	FastqReader reader1("testdata/R1.fq");
-	FastqReader reader2("testdata/R1.fq.gz");
-	Read* r1 = NULL;
-	Read* r2 = NULL;
-	while(true){
-		r1=reader1.read();
-		r2=reader2.read();
-		if(r1 == NULL || r2 == NULL)
-			break;
-		if(r1->mSeq.mStr != r2->mSeq.mStr){
+// check the records read from filename by both read() and readRecord()
+static bool checkFastqFile(string filename, const vector<string>& lines, bool noLineBreakAtEnd) {
+	FastqReader reader1(filename);
+	FastqReader reader2(filename);
+	FastqRecord rec;
+	for(size_t i=0; i<lines.size(); i+=4) {
+		Read* r = reader1.read();
+		if(r == NULL || !reader2.readRecord(rec)) {
+			delete r;
+			return false;
+		}
+		bool same = r->mName == lines[i] && r->mSeq.mStr == lines[i+1] && r->mStrand == lines[i+2] && r->mQuality == lines[i+3];
+		same &= string(rec.name, rec.nameLen) == lines[i] && string(rec.seq, rec.seqLen) == lines[i+1]
+			&& string(rec.strand, rec.strandLen) == lines[i+2] && string(rec.qual, rec.qualLen) == lines[i+3];
+		delete r;
+		if(!same) {
+			cerr << "FastqReader::test failed at record " << i/4 << " of " << filename << endl;
 			return false;
 		}
-		delete r1;
-		delete r2;
 	}
-	return true;
+	if(reader1.read() != NULL || reader2.readRecord(rec))
+		return false;
+	return reader1.hasNoLineBreakAtEnd() == noLineBreakAtEnd;
+}
+
+bool FastqReader::test(){
+	// records of different lengths to cross the buffer boundaries, some with \r\n
+	// and one record longer than the initial buffer, which makes the buffer grow
+	vector<string> lines;
+	string text;
+	for(int i=0; i<30000; i++) {
+		int len = (i == 15000) ? FQ_BUF_SIZE * 3 : 1 + (i * 37) % 300;
+		string seq(len, 'A');
+		string qual(len, 'F');
+		for(int p=0; p<len; p++) {
+			seq[p] = "ACGTN"[(i + p * 7) % 5];
+			qual[p] = '#' + (i + p) % 40;
+		}
+		lines.push_back("@read" + to_string(i) + " 1:N:0:ACGT");
+		lines.push_back(seq);
+		lines.push_back(i % 3 == 0 ? "+read" + to_string(i) : "+");
+		lines.push_back(qual);
+		const char* lineBreak = (i % 5 == 0) ? "\r\n" : "\n";
+		for(size_t l=lines.size()-4; l<lines.size(); l++)
+			text += lines[l] + lineBreak;
+	}
+
+	char tmpl[] = "/tmp/repaq_fastqreader_XXXXXX";
+	int fd = mkstemp(tmpl);
+	if(fd < 0)
+		return false;
+	::close(fd);
+	string plain = string(tmpl) + ".fq";
+	string noBreak = string(tmpl) + ".nobreak.fq";
+	string zipped = string(tmpl) + ".fq.gz";
+
+	bool passed = true;
+	FILE* fp = fopen(plain.c_str(), "wb");
+	passed &= fp && fwrite(text.data(), 1, text.length(), fp) == text.length();
+	if(fp) fclose(fp);
+	// the last line has no line break
+	fp = fopen(noBreak.c_str(), "wb");
+	passed &= fp && fwrite(text.data(), 1, text.length() - 1, fp) == text.length() - 1;
+	if(fp) fclose(fp);
+	gzFile gz = gzopen(zipped.c_str(), "wb");
+	passed &= gz && gzwrite(gz, text.data(), text.length()) == (int)text.length();
+	if(gz) gzclose(gz);
+
+	if(passed) {
+		passed &= checkFastqFile(plain, lines, false);
+		passed &= checkFastqFile(noBreak, lines, true);
+		passed &= checkFastqFile(zipped, lines, false);
+	}
+
+	remove(tmpl);
+	remove(plain.c_str());
+	remove(noBreak.c_str());
+	remove(zipped.c_str());
+	return passed;
 }
 
 FastqReaderPair::FastqReaderPair(FastqReader* left, FastqReader* right){
@@ -9,6 +9,20 @@
 #include <iostream>
 #include <fstream>
 
+// a FASTQ record pointing into the buffer of FastqReader
+// it is only valid until the next call of FastqReader::readRecord() or FastqReader::read()
+struct FastqRecord{
+	const char* name;
+	int nameLen;
+	const char* seq;
+	int seqLen;
+	const char* strand;
+	int strandLen;
+	// NULL if the reader has no quality
+	const char* qual;
+	int qualLen;
+};
+
 class FastqReader{
 public:
 	FastqReader(string filename, bool hasQuality = true, bool phred64=false);
@@ -20,6 +34,8 @@ public:
 	//this function is not thread-safe
 	//do not call read() of a same FastqReader object from different threads concurrently
 	Read* read();
+	// parse the next record without any copy, return false if no more record
+	bool readRecord(FastqRecord& rec);
 	bool eof();
 	bool hasNoLineBreakAtEnd();
 
@@ -31,7 +47,7 @@ public:
 private:
 	void init();
 	void close();
-	string getLine();
+	bool getLine(int& pos, const char*& line, int& len);
 	void clearLineBreaks(char* line);
 	void readToBuf();
 
@@ -43,10 +59,12 @@ private:
 	bool mHasQuality;
 	bool mPhred64;
 	char* mBuf;
+	int mBufSize;
 	int mBufDataLen;
 	int mBufUsedLen;
 	bool mStdinMode;
 	bool mHasNoLineBreakAtEnd;
+	bool mReachedEnd;
 
 };
 
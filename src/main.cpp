@@ -7,11 +7,25 @@
 #include <sstream>
 #include <iostream>
 #include <unistd.h>
+#include <errno.h>
+#include <ctype.h>
 #include "repaq.h"
 #include "util.h"
 
 string command;
 
+// parse a field of --range, which must be a whole decimal number
+static long parseRangeField(const string& field, const string& range) {
+    if(field.empty() || isspace(field[0]))
+        error_exit("--range should be <start>:<count>, but got " + range);
+    char* end = NULL;
+    errno = 0;
+    long val = strtol(field.c_str(), &end, 10);
+    if(*end != '\0' || errno == ERANGE)
+        error_exit("--range should be <start>:<count>, but got " + range);
+    return val;
+}
+
 int main(int argc, char* argv[]){
     // display version info if no argument is given
     if(argc == 1) {
@@ -43,8 +57,15 @@ int main(int argc, char* argv[]){
     cmd.add("compare", 'p', "compare the files read by read to check the compression consistency. <rfq_to_compare> should be specified in this mode.");
     cmd.add<string>("rfq_to_compare", 'r', "the RFQ file to be compared with the input. This option is only used in compare mode.", false, "");
     cmd.add<string>("json_compare_result", 'j', "the file to store the comparison result. This is optional since the result is also printed on STDOUT.", false, "");
+    // random access
+    cmd.add("no_index", 0, "don't write the chunk index at the end of the RFQ file, then --range has to scan the file from the beginning.");
+    cmd.add<string>("range", 0, "only decompress the reads in <start>:<count>. <start> is 0-based, and the reads are counted by pairs for paired-end data.", false, "");
+    // sequence and quality coding
+    cmd.add<string>("seq_codec", 0, "the codec of sequences when compressing, packed (2 bits per base, default) or cm (order-12 context model, much smaller for high coverage data but slower).", false, "packed");
+    cmd.add<string>("qual_codec", 0, "the codec of quality scores when compressing, col (run length or column coding, or 2-bit planes for 4 or fewer qualities when they are not bigger, default), rans (entropy coding, better ratio without xz) or cm (context models, the best ratio but slower) or auto (try them on every chunk and use the smallest).", false, "col");
+    cmd.add<int>("qual_trial_reads", 0, "in --qual_codec auto mode, the codecs are tried on the first <qual_trial_reads> reads of every chunk, 0 means the whole chunk (default 2000).", false, 2000);
     // threading
-    cmd.add<int>("thread", 't', "thread number for xz compression (default 1). When compression level (-z) is >= 4, no threading will be used.", false, 1);
+    cmd.add<int>("thread", 't', "thread number for encoding and xz compression (default 1). When compression level (-z) is >= 4, no threading will be used for xz.", false, 1);
     // compression level
     cmd.add<int>("compression", 'z', "compression level. Higher level means higher compression ratio, and more RAM usage (1~9), default 3.", false, 3);
 
@@ -71,9 +92,23 @@ int main(int argc, char* argv[]){
     opt.outputToSTDOUT = cmd.exist("stdout");
     opt.interleavedInput = cmd.exist("interleaved_in");
     int threadNum = cmd.get<int>("thread");
-    threadNum = max(1, min(16, threadNum));
+    threadNum = max(1, min(64, threadNum));
+    opt.threadNum = threadNum;
+    opt.qualCodec = cmd.get<string>("qual_codec");
+    opt.qualTrialReads = cmd.get<int>("qual_trial_reads");
+    opt.seqCodec = cmd.get<string>("seq_codec");
     int compression = cmd.get<int>("compression");
     compression = max(1, min(9, compression));
+    opt.writeIndex = !cmd.exist("no_index");
+    string range = cmd.get<string>("range");
+    if(!range.empty()) {
+        size_t colon = range.find(':');
+        if(colon == string::npos)
+            error_exit("--range should be <start>:<count>, but got " + range);
+        opt.rangeMode = true;
+        opt.rangeStart = parseRangeField(range.substr(0, colon), range);
+        opt.rangeCount = parseRangeField(range.substr(colon + 1), range);
+    }
     opt.completeCheck = cmd.exist("verify");
     opt.fastCheck = cmd.exist("fast_verify");
 
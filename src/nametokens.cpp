@@ -0,0 +1,501 @@
+#include "nametokens.h"
+#include "rans.h"
+#include "util.h"
+#include <memory.h>
+
+#define TOKEN_END 0
+#define TOKEN_MATCH 1
+#define TOKEN_DELTA 2
+#define TOKEN_NUMBER 3
+#define TOKEN_STRING 4
+
+// a number token has 9 digits at most, so its value fits uint32
+#define MAX_NUMBER_DIGITS 9
+
+#define STREAM_RAW 0
+#define STREAM_RANS 1
+
+static inline void putVarint(vector<uint8>& out, uint32 val) {
+    while(val >= 0x80) {
+        out.push_back((val & 0x7F) | 0x80);
+        val >>= 7;
+    }
+    out.push_back(val);
+}
+
+static inline uint32 getVarint(const vector<uint8>& in, size_t& pos) {
+    uint32 val = 0;
+    for(int shift=0; shift<35; shift+=7) {
+        if(pos >= in.size())
+            error_exit("the name tokens are truncated");
+        uint8 byte = in[pos++];
+        val |= (uint32)(byte & 0x7F) << shift;
+        if((byte & 0x80) == 0)
+            return val;
+    }
+    error_exit("bad varint in the name tokens");
+    return 0;
+}
+
+static inline void putUInt32(vector<uint8>& out, uint32 val) {
+    for(int b=0; b<4; b++)
+        out.push_back((val >> (b*8)) & 0xFF);
+}
+
+static inline uint32 getUInt32(const uint8* p) {
+    return (uint32)p[0] | ((uint32)p[1] << 8) | ((uint32)p[2] << 16) | ((uint32)p[3] << 24);
+}
+
+// print the value with leading zeros to len digits
+static inline void writeNumber(string& out, uint32 value, uint32 len) {
+    size_t start = out.length();
+    out.resize(start + len);
+    for(uint32 i=0; i<len; i++) {
+        out[start + len - 1 - i] = '0' + value % 10;
+        value /= 10;
+    }
+}
+
+void NameTokens::tokenize(const char* name, uint32 len, vector<NameToken>& tokens) {
+    tokens.clear();
+    uint32 i = 0;
+    while(i < len) {
+        bool isDigit = name[i] >= '0' && name[i] <= '9';
+        uint32 end = i + 1;
+        while(end < len && (name[end] >= '0' && name[end] <= '9') == isDigit)
+            end++;
+        if(!isDigit) {
+            NameToken token = {false, i, end - i, 0};
+            tokens.push_back(token);
+            i = end;
+            continue;
+        }
+        // a long run of digits is split from the right, so the lowest digits, which change most, are in one token
+        uint32 first = (end - i) % MAX_NUMBER_DIGITS;
+        if(first == 0)
+            first = MAX_NUMBER_DIGITS;
+        while(i < end) {
+            NameToken token = {true, i, first, 0};
+            for(uint32 d=i; d<i+first; d++)
+                token.value = token.value * 10 + (name[d] - '0');
+            tokens.push_back(token);
+            i += first;
+            first = MAX_NUMBER_DIGITS;
+        }
+    }
+}
+
+static void putStream(const vector<uint8>& stream, vector<uint8>& out) {
+    vector<uint8> coded;
+    if(!stream.empty())
+        Rans::encode(stream.data(), stream.size(), 1, coded);
+    if(!coded.empty() && coded.size() < stream.size()) {
+        out.push_back(STREAM_RANS);
+        putUInt32(out, coded.size());
+        out.insert(out.end(), coded.begin(), coded.end());
+    } else {
+        out.push_back(STREAM_RAW);
+        putUInt32(out, stream.size());
+        out.insert(out.end(), stream.begin(), stream.end());
+    }
+}
+
+static const uint8* getStream(const uint8* p, const uint8* end, vector<uint8>& stream) {
+    if(p + 5 > end)
+        error_exit("the name tokens are truncated");
+    uint8 codec = p[0];
+    uint32 size = getUInt32(p + 1);
+    p += 5;
+    if(size > (uint32)(end - p))
+        error_exit("the name tokens are truncated");
+    if(codec == STREAM_RAW) {
+        stream.assign(p, p + size);
+    } else if(codec == STREAM_RANS) {
+        stream.resize(Rans::decodedLength(p, size));
+        Rans::decode(p, size, stream.data(), stream.size());
+    } else {
+        error_exit("unknown codec of the name tokens");
+    }
+    return p + size;
+}
+
+void NameTokens::encode(const char* names, const uint32* lens, int count, vector<uint8>& out) {
+    mOps.clear();
+    mNumbers.clear();
+    mStrings.clear();
+    mPrevTokens.clear();
+
+    const char* name = names;
+    const char* prevName = names;
+    uint32 totalLen = 0;
+    for(int n=0; n<count; n++) {
+        tokenize(name, lens[n], mTokens);
+        for(size_t t=0; t<mTokens.size(); t++) {
+            const NameToken& token = mTokens[t];
+            const NameToken* prev = t < mPrevTokens.size() ? &mPrevTokens[t] : NULL;
+            if(prev && prev->isNumber == token.isNumber && prev->len == token.len
+                && memcmp(prevName + prev->start, name + token.start, token.len) == 0) {
+                mOps.push_back(TOKEN_MATCH);
+            } else if(token.isNumber && prev && prev->isNumber && prev->len == token.len
+                && token.value > prev->value && token.value - prev->value < 256) {
+                mOps.push_back(TOKEN_DELTA);
+                mNumbers.push_back(token.value - prev->value);
+            } else if(token.isNumber) {
+                mOps.push_back(TOKEN_NUMBER);
+                mNumbers.push_back(token.len);
+                putVarint(mNumbers, token.value);
+            } else {
+                mOps.push_back(TOKEN_STRING);
+                putVarint(mStrings, token.len);
+                mStrings.insert(mStrings.end(), name + token.start, name + token.start + token.len);
+            }
+        }
+        mOps.push_back(TOKEN_END);
+        mPrevTokens.swap(mTokens);
+        prevName = name;
+        name += lens[n];
+        totalLen += lens[n];
+    }
+
+    size_t start = out.size();
+    out.push_back(NAME_TOKENS_CODED);
+    putStream(mOps, out);
+    putStream(mNumbers, out);
+    putStream(mStrings, out);
+
+    // the tokens don't help, keep the names raw
+    if(out.size() - start > totalLen + 1) {
+        out.resize(start);
+        out.push_back(NAME_TOKENS_RAW);
+        out.insert(out.end(), names, names + totalLen);
+    }
+}
+
+void NameTokens::decode(const uint8* in, uint32 inLen, int count, string& names) {
+    if(inLen < 1)
+        error_exit("the name tokens are truncated");
+    if(in[0] == NAME_TOKENS_RAW) {
+        names.append((const char*)in + 1, inLen - 1);
+        return;
+    }
+    if(in[0] != NAME_TOKENS_CODED)
+        error_exit("unknown coding method of the names");
+
+    const uint8* p = in + 1;
+    const uint8* end = in + inLen;
+    p = getStream(p, end, mOps);
+    p = getStream(p, end, mNumbers);
+    p = getStream(p, end, mStrings);
+
+    size_t opPos = 0;
+    size_t numberPos = 0;
+    size_t stringPos = 0;
+    size_t prevStart = names.length();
+    mPrevTokens.clear();
+    for(int n=0; n<count; n++) {
+        size_t nameStart = names.length();
+        mTokens.clear();
+        while(true) {
+            if(opPos >= mOps.size())
+                error_exit("the name tokens are truncated");
+            uint8 op = mOps[opPos++];
+            if(op == TOKEN_END)
+                break;
+            size_t t = mTokens.size();
+            const NameToken* prev = t < mPrevTokens.size() ? &mPrevTokens[t] : NULL;
+            NameToken token = {false, (uint32)(names.length() - nameStart), 0, 0};
+            switch(op) {
+                case TOKEN_MATCH:
+                    if(!prev)
+                        error_exit("bad name tokens: no token to match");
+                    token.isNumber = prev->isNumber;
+                    token.len = prev->len;
+                    token.value = prev->value;
+                    names.append(names, prevStart + prev->start, prev->len);
+                    break;
+                case TOKEN_DELTA:
+                    if(!prev || !prev->isNumber || numberPos >= mNumbers.size())
+                        error_exit("bad name tokens: no number to add to");
+                    token.isNumber = true;
+                    token.len = prev->len;
+                    token.value = prev->value + mNumbers[numberPos++];
+                    writeNumber(names, token.value, token.len);
+                    break;
+                case TOKEN_NUMBER:
+                    if(numberPos >= mNumbers.size())
+                        error_exit("the name tokens are truncated");
+                    token.isNumber = true;
+                    token.len = mNumbers[numberPos++];
+                    token.value = getVarint(mNumbers, numberPos);
+                    writeNumber(names, token.value, token.len);
+                    break;
+                case TOKEN_STRING:
+                    token.len = getVarint(mStrings, stringPos);
+                    if(stringPos + token.len > mStrings.size())
+                        error_exit("the name tokens are truncated");
+                    names.append((const char*)mStrings.data() + stringPos, token.len);
+                    stringPos += token.len;
+                    break;
+                default:
+                    error_exit("bad name tokens: unknown operation");
+            }
+            mTokens.push_back(token);
+        }
+        mPrevTokens.swap(mTokens);
+        prevStart = nameStart;
+    }
+}
+
+bool NameTokens::test() {
+    vector<string> cases;
+    cases.push_back("@V300012345L1C001R0010000001/1");
+    cases.push_back("@V300012345L1C001R0010000001/2");
+    cases.push_back("@V300012345L1C001R0010000002/1");
+    cases.push_back("@V300012345L1C001R0010000002/2");
+    // the lowest digits wrap around, and a number gets longer
+    cases.push_back("@V300012345L1C001R0010000099/1");
+    cases.push_back("@V300012345L1C001R0010000100/1");
+    cases.push_back("@SRR123456.99 99 length=150");
+    cases.push_back("@SRR123456.100 100 length=150");
+    cases.push_back("@SRR123456.101 101 length=98");
+    cases.push_back("");
+    cases.push_back("12345678901234567890");
+    cases.push_back("@read_without_numbers");
+    cases.push_back("@read_without_numbers");
+
+    string names;
+    vector<uint32> lens;
+    for(size_t c=0; c<cases.size(); c++) {
+        names += cases[c];
+        lens.push_back(cases[c].length());
+    }
+    // many names to get the streams rANS coded
+    for(int i=0; i<1000; i++) {
+        string name = "@SRR123456." + to_string(i + 200) + " " + to_string(i + 200) + " length=150";
+        names += name;
+        lens.push_back(name.length());
+    }
+
+    NameTokens coder;
+    vector<uint8> encoded;
+    coder.encode(names.data(), lens.data(), lens.size(), encoded);
+    if(encoded[0] != NAME_TOKENS_CODED || encoded.size() * 4 > names.length())
+        return false;
+    string decoded = "prefix";
+    coder.decode(encoded.data(), encoded.size(), lens.size(), decoded);
+    if(decoded != "prefix" + names) {
+        cerr << "NameTokens::test failed" << endl;
+        return false;
+    }
+    return true;
+}
+
+// the barcode bases are packed as A:0 C:1 G:2 T:3
+static inline int barcodeCode(char c) {
+    switch(c) {
+        case 'A': return 0;
+        case 'C': return 1;
+        case 'G': return 2;
+        case 'T': return 3;
+        default: return -1;
+    }
+}
+
+// an entry is <len:uint8><prefix len:uint8><prefix><exceptions:uint8><exceptions of <pos:uint8><char>><packed barcode>
+// the prefix is the name2 up to the last colon, or the whole name2 if the rest doesn't look like a barcode
+void NameDict::putEntry(const char* name, uint32 len, vector<uint8>& out) {
+    uint32 prefixLen = 0;
+    for(uint32 i=0; i<len; i++) {
+        if(name[i] == ':')
+            prefixLen = i + 1;
+    }
+    uint32 exceptions = 0;
+    for(uint32 i=prefixLen; i<len; i++) {
+        if(barcodeCode(name[i]) < 0)
+            exceptions++;
+    }
+    if(exceptions * 4 > len - prefixLen) {
+        prefixLen = len;
+        exceptions = 0;
+    }
+
+    out.push_back(len);
+    out.push_back(prefixLen);
+    out.insert(out.end(), name, name + prefixLen);
+    out.push_back(exceptions);
+    for(uint32 i=prefixLen; i<len; i++) {
+        if(barcodeCode(name[i]) < 0) {
+            out.push_back(i - prefixLen);
+            out.push_back(name[i]);
+        }
+    }
+    uint8 packed = 0;
+    for(uint32 i=prefixLen; i<len; i++) {
+        int code = max(0, barcodeCode(name[i]));
+        packed |= code << (((i - prefixLen) % 4) * 2);
+        if((i - prefixLen) % 4 == 3 || i == len - 1) {
+            out.push_back(packed);
+            packed = 0;
+        }
+    }
+}
+
+void NameDict::getEntry(const vector<uint8>& in, size_t& pos, string& entry) {
+    if(pos + 2 > in.size())
+        error_exit("the name2 dictionary is truncated");
+    uint32 len = in[pos++];
+    uint32 prefixLen = in[pos++];
+    if(prefixLen > len || pos + prefixLen + 1 > in.size())
+        error_exit("the name2 dictionary is truncated");
+    entry.assign((const char*)in.data() + pos, prefixLen);
+    pos += prefixLen;
+    uint32 exceptions = in[pos++];
+    size_t exceptionPos = pos;
+    pos += exceptions * 2;
+    uint32 barcodeLen = len - prefixLen;
+    uint32 packedLen = (barcodeLen + 3) / 4;
+    if(pos + packedLen > in.size())
+        error_exit("the name2 dictionary is truncated");
+    for(uint32 i=0; i<barcodeLen; i++)
+        entry += "ACGT"[(in[pos + i/4] >> ((i%4) * 2)) & 0x03];
+    pos += packedLen;
+    for(uint32 e=0; e<exceptions; e++) {
+        uint32 p = in[exceptionPos + e*2];
+        if(p >= barcodeLen)
+            error_exit("bad exception in the name2 dictionary");
+        entry[prefixLen + p] = in[exceptionPos + e*2 + 1];
+    }
+}
+
+void NameDict::encode(const char* names, const uint32* lens, int count, vector<uint8>& out) {
+    mIndex.clear();
+    mEntryStream.clear();
+    mRefs.clear();
+
+    const char* name = names;
+    uint32 totalLen = 0;
+    vector<uint32> refs(count);
+    for(int n=0; n<count; n++) {
+        mKey.assign(name, lens[n]);
+        unordered_map<string, uint32>::iterator iter = mIndex.find(mKey);
+        if(iter == mIndex.end()) {
+            uint32 ref = mIndex.size();
+            mIndex[mKey] = ref;
+            putEntry(name, lens[n], mEntryStream);
+            refs[n] = ref;
+        } else {
+            refs[n] = iter->second;
+        }
+        name += lens[n];
+        totalLen += lens[n];
+    }
+
+    uint32 entries = mIndex.size();
+    int refBytes = 1;
+    if(entries > 0x10000)
+        refBytes = 4;
+    else if(entries > 0x100)
+        refBytes = 2;
+    for(int n=0; n<count; n++) {
+        for(int b=0; b<refBytes; b++)
+            mRefs.push_back((refs[n] >> (b*8)) & 0xFF);
+    }
+
+    size_t start = out.size();
+    out.push_back(NAME_DICT_CODED);
+    putUInt32(out, entries);
+    out.push_back(refBytes);
+    putStream(mEntryStream, out);
+    putStream(mRefs, out);
+
+    // the dictionary doesn't help, keep the names raw
+    if(out.size() - start > totalLen + 1) {
+        out.resize(start);
+        out.push_back(NAME_DICT_RAW);
+        out.insert(out.end(), names, names + totalLen);
+    }
+}
+
+void NameDict::decode(const uint8* in, uint32 inLen, int count, string& names) {
+    if(inLen < 1)
+        error_exit("the name2 dictionary is truncated");
+    if(in[0] == NAME_DICT_RAW) {
+        names.append((const char*)in + 1, inLen - 1);
+        return;
+    }
+    if(in[0] != NAME_DICT_CODED || inLen < 6)
+        error_exit("unknown coding method of the name2");
+
+    uint32 entries = getUInt32(in + 1);
+    int refBytes = in[5];
+    if(refBytes != 1 && refBytes != 2 && refBytes != 4)
+        error_exit("bad reference size of the name2 dictionary");
+    const uint8* p = in + 6;
+    const uint8* end = in + inLen;
+    p = getStream(p, end, mEntryStream);
+    p = getStream(p, end, mRefs);
+    if(mRefs.size() != (size_t)count * refBytes)
+        error_exit("the name2 dictionary is inconsistent with the reads");
+
+    // an entry has 3 bytes at least, which bounds the count of a broken file
+    if(entries > mEntryStream.size() / 3)
+        error_exit("the name2 dictionary is truncated");
+    mEntries.resize(entries);
+    size_t pos = 0;
+    for(uint32 e=0; e<entries; e++)
+        getEntry(mEntryStream, pos, mEntries[e]);
+
+    for(int n=0; n<count; n++) {
+        uint32 ref = 0;
+        for(int b=0; b<refBytes; b++)
+            ref |= (uint32)mRefs[n*refBytes + b] << (b*8);
+        if(ref >= entries)
+            error_exit("bad reference in the name2 dictionary");
+        names += mEntries[ref];
+    }
+}
+
+bool NameDict::test() {
+    vector<string> cases;
+    cases.push_back("1:N:0:ACGTACGT+TTGGCCAA");
+    cases.push_back("2:N:0:ACGTACGT+TTGGCCAA");
+    cases.push_back("1:N:0:NNNNNNNN+TTGGCCAA");
+    cases.push_back("1:N:0:ACGTACGT+TTGGCCAA");
+    cases.push_back("1:N:0:2");
+    cases.push_back("");
+    cases.push_back("length=150");
+    cases.push_back("1:Y:18:GATTACA");
+
+    NameDict coder;
+    for(int round=0; round<2; round++) {
+        string names;
+        vector<uint32> lens;
+        for(size_t c=0; c<cases.size(); c++) {
+            names += cases[c];
+            lens.push_back(cases[c].length());
+        }
+        // many reads with a few barcodes, or more than 256 barcodes for 2-byte references
+        int barcodes = round == 0 ? 10 : 300;
+        for(int i=0; i<3000; i++) {
+            string name = "1:N:0:";
+            uint32 code = (i * 7919) % barcodes;
+            for(int b=0; b<8; b++)
+                name += "ACGT"[(code >> (b*2)) & 0x03];
+            name += "+AACCGGTT";
+            names += name;
+            lens.push_back(name.length());
+        }
+
+        vector<uint8> encoded;
+        coder.encode(names.data(), lens.data(), lens.size(), encoded);
+        if(encoded[0] != NAME_DICT_CODED || encoded.size() * 4 > names.length())
+            return false;
+        string decoded = "prefix";
+        coder.decode(encoded.data(), encoded.size(), lens.size(), decoded);
+        if(decoded != "prefix" + names) {
+            cerr << "NameDict::test failed" << endl;
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,88 @@
+#ifndef NAME_TOKENS_H
+#define NAME_TOKENS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "common.h"
+
+using namespace std;
+
+/*
+* the token coding of the query names that don't have the Illumina layout, like
+* @V300012345L1C001R0010000001/1 (BGI/MGI) or @SRR123456.45 45 length=150 (SRA)
+* a name is split to the tokens of digits and the tokens of other characters, and every token is coded
+* against the token at the same index of the previous name:
+* MATCH (the same), DELTA (a number increased by < 256), NUMBER or STRING (a new token), and END ends a name
+* the operations, numbers and strings are kept in 3 streams, and each is rANS coded if it gets smaller
+* the encoded data is:
+* <method:uint8>, then the raw names for NAME_TOKENS_RAW, or 3 streams of <codec:uint8><size:uint32><data>
+*/
+
+#define NAME_TOKENS_RAW 0
+#define NAME_TOKENS_CODED 1
+
+/*
+* the dictionary coding of name2 (like 1:N:0:ACGTACGT+TTGGCCAA), which has a few distinct values in a chunk
+* every distinct name2 is stored once, and every read refers to it by its index in the dictionary
+* in a dictionary entry, the barcode after the last colon is packed in 2 bits per base, and the other
+* characters (like N and +) are stored as the exceptions
+* the encoded data is:
+* <method:uint8>, then the raw names for NAME_DICT_RAW, or <entries:uint32><ref bytes:uint8>
+* and 2 streams (the entries and the refs) of <codec:uint8><size:uint32><data>
+*/
+
+#define NAME_DICT_RAW 0
+#define NAME_DICT_CODED 1
+
+struct NameToken{
+    bool isNumber;
+    // the offset in the name, and the length
+    uint32 start;
+    uint32 len;
+    // the value of a number, which is printed with leading zeros to len digits
+    uint32 value;
+};
+
+class NameTokens{
+public:
+    // encode count names, which are concatenated in names and have the lengths lens, and append the encoded data to out
+    void encode(const char* names, const uint32* lens, int count, vector<uint8>& out);
+    // decode the data encoded by encode(), and append the concatenated names to names
+    void decode(const uint8* in, uint32 inLen, int count, string& names);
+    static bool test();
+
+private:
+    static void tokenize(const char* name, uint32 len, vector<NameToken>& tokens);
+
+private:
+    vector<NameToken> mTokens;
+    vector<NameToken> mPrevTokens;
+    vector<uint8> mOps;
+    vector<uint8> mNumbers;
+    vector<uint8> mStrings;
+};
+
+class NameDict{
+public:
+    // encode count names, which are concatenated in names and have the lengths lens, and append the encoded data to out
+    void encode(const char* names, const uint32* lens, int count, vector<uint8>& out);
+    // decode the data encoded by encode(), and append the concatenated names to names
+    void decode(const uint8* in, uint32 inLen, int count, string& names);
+    static bool test();
+
+private:
+    static void putEntry(const char* name, uint32 len, vector<uint8>& out);
+    static void getEntry(const vector<uint8>& in, size_t& pos, string& entry);
+
+private:
+    unordered_map<string, uint32> mIndex;
+    string mKey;
+    vector<string> mEntries;
+    vector<uint8> mEntryStream;
+    vector<uint8> mRefs;
+};
+
+#endif
@@ -12,6 +12,14 @@ Options::Options(){
     out2 = "";
     chunkSize = 1000;
     mode = REPAQ_COMPRESS;
+    threadNum = 1;
+    qualCodec = "col";
+    qualTrialReads = 2000;
+    seqCodec = "packed";
+    writeIndex = true;
+    rangeMode = false;
+    rangeStart = 0;
+    rangeCount = 0;
     inputFromSTDIN = false;
     outputToSTDOUT = false;
     interleavedInput = false;
@@ -83,6 +91,20 @@ bool Options::validate() {
             error_exit("In decompress mode, the read2 output should not be a RFQ file. Expect a .fq or .fq.gz file, but got " + out2);
     }
 
+    if(qualCodec != "col" && qualCodec != "rans" && qualCodec != "cm" && qualCodec != "auto")
+        error_exit("--qual_codec should be col, rans, cm or auto, but got " + qualCodec);
+    if(qualTrialReads < 0)
+        error_exit("--qual_trial_reads should not be negative");
+    if(seqCodec != "packed" && seqCodec != "cm")
+        error_exit("--seq_codec should be packed or cm, but got " + seqCodec);
+
+    if(rangeMode) {
+        if(mode != REPAQ_DECOMPRESS)
+            error_exit("--range can only be used in decompress mode");
+        if(rangeStart < 0 || rangeCount <= 0)
+            error_exit("--range should be <start>:<count>, with start >= 0 and count > 0");
+    }
+
     if(mode == REPAQ_COMPARE) {
         if(inputFromSTDIN)
             rfqCompare = "/dev/stdin";
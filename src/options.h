@@ -37,6 +37,24 @@ public:
     int chunkSize;
     int mode;
 
+    // threading
+    int threadNum;
+
+    // the quality codec, col (the built-in run length or column coding), rans, cm (context models) or auto (chosen for every chunk)
+    string qualCodec;
+    // the reads of a chunk trial encoded by every quality codec in auto mode, 0 for the whole chunk
+    int qualTrialReads;
+    // the sequence codec, packed (2 bits per base) or cm (order-k context model)
+    string seqCodec;
+
+    // random access
+    // write the index of chunks at the end of RFQ
+    bool writeIndex;
+    // only decompress <rangeCount> reads (pairs for paired-end data) from <rangeStart>, which is 0-based
+    bool rangeMode;
+    long rangeStart;
+    long rangeCount;
+
     // for double check
     bool completeCheck;
     bool fastCheck;
@@ -0,0 +1,111 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <map>
+
+using namespace std;
+
+/*
+* building blocks of the multi-threaded pipelines
+* a producer pushes numbered tasks into a TaskQueue, a pool of workers pops and processes them,
+* then a consumer takes the results from a ReorderBuffer strictly in the input order
+*/
+
+// a bounded FIFO queue, push() blocks when it's full, and pop() blocks when it's empty
+template<typename T>
+class TaskQueue{
+public:
+    TaskQueue(size_t capacity) {
+        mCapacity = capacity;
+        mClosed = false;
+    }
+
+    void push(T item) {
+        unique_lock<mutex> lock(mMutex);
+        mNotFull.wait(lock, [this]{ return mItems.size() < mCapacity; });
+        mItems.push_back(item);
+        mNotEmpty.notify_one();
+    }
+
+    // return false if the queue is closed and all items have been popped
+    bool pop(T& item) {
+        unique_lock<mutex> lock(mMutex);
+        mNotEmpty.wait(lock, [this]{ return !mItems.empty() || mClosed; });
+        if(mItems.empty())
+            return false;
+        item = mItems.front();
+        mItems.pop_front();
+        mNotFull.notify_one();
+        return true;
+    }
+
+    // no more items will be pushed
+    void close() {
+        lock_guard<mutex> lock(mMutex);
+        mClosed = true;
+        mNotEmpty.notify_all();
+    }
+
+private:
+    size_t mCapacity;
+    bool mClosed;
+    deque<T> mItems;
+    mutex mMutex;
+    condition_variable mNotFull;
+    condition_variable mNotEmpty;
+};
+
+// results are put in any order, and taken out strictly by their sequence number (0, 1, 2...)
+// put() blocks if the result is too far ahead of the one being waited, to bound the memory
+template<typename T>
+class ReorderBuffer{
+public:
+    ReorderBuffer(long capacity) {
+        mCapacity = capacity;
+        mNext = 0;
+        mTotal = -1;
+    }
+
+    void put(long seq, T item) {
+        unique_lock<mutex> lock(mMutex);
+        mNotFull.wait(lock, [this, seq]{ return seq < mNext + mCapacity; });
+        mItems[seq] = item;
+        mReady.notify_all();
+    }
+
+    // return false if all the results have been taken
+    bool next(T& item) {
+        unique_lock<mutex> lock(mMutex);
+        mReady.wait(lock, [this]{ return mItems.count(mNext) > 0 || (mTotal >= 0 && mNext >= mTotal); });
+        if(mItems.count(mNext) == 0)
+            return false;
+        item = mItems[mNext];
+        mItems.erase(mNext);
+        mNext++;
+        mNotFull.notify_all();
+        return true;
+    }
+
+    // tell the consumer how many results will be put in total
+    void finish(long total) {
+        lock_guard<mutex> lock(mMutex);
+        mTotal = total;
+        mReady.notify_all();
+    }
+
+private:
+    long mCapacity;
+    long mNext;
+    long mTotal;
+    map<long, T> mItems;
+    mutex mMutex;
+    condition_variable mNotFull;
+    condition_variable mReady;
+};
+
+#endif
@@ -0,0 +1,173 @@
+#include "qualcm.h"
+#include "rangecoder.h"
+#include "util.h"
+#include <memory.h>
+
+// the cycles are binned as 0..7 one by one, and then every 32 cycles
+#define QUALCM_CYCLE_BINS 16
+// the previous quality has up to 64 levels, and the one before has up to 16 levels
+#define QUALCM_Q1_LEVELS 64
+#define QUALCM_Q2_LEVELS 16
+
+int QualCM::cycleBin(uint32 pos) {
+    if(pos < 8)
+        return pos;
+    return min(QUALCM_CYCLE_BINS - 1, 8 + (int)((pos - 8) >> 5));
+}
+
+int QualCM::contextCount(int symbols) {
+    return QUALCM_CYCLE_BINS * min(symbols, QUALCM_Q1_LEVELS) * min(symbols, QUALCM_Q2_LEVELS);
+}
+
+uint32 QualCM::bound(uint32 len) {
+    // a symbol costs 16 bits at most, with the table and the flushed bytes
+    return 5 + 256 + len * 2 + 16;
+}
+
+// the context of a quality is <cycle bin, q[-1] level, q[-2] level>
+// the levels are the symbols scaled down when there are many symbols
+#define QUALCM_CONTEXT(cycle, q1, q2) \
+    ((cycleBin(cycle) * q1Levels + (q1) * q1Levels / symbols) * q2Levels + (q2) * q2Levels / symbols)
+
+void QualCM::encode(const uint8* qual, const uint32* readLens, int reads, bool reverseOdd, vector<uint8>& out) {
+    uint32 len = 0;
+    for(int r=0; r<reads; r++)
+        len += readLens[r];
+
+    int symOfQual[256];
+    for(int q=0; q<256; q++)
+        symOfQual[q] = -1;
+    for(uint32 i=0; i<len; i++)
+        symOfQual[qual[i]] = 0;
+    int symbols = 0;
+    vector<uint8> quals;
+    for(int q=0; q<256; q++) {
+        if(symOfQual[q] < 0)
+            continue;
+        symOfQual[q] = symbols++;
+        quals.push_back(q);
+    }
+    if(symbols == 0) {
+        symbols = 1;
+        quals.push_back(0);
+    }
+
+    for(int b=0; b<4; b++)
+        out.push_back((len >> (b*8)) & 0xFF);
+    out.push_back(symbols - 1);
+    out.insert(out.end(), quals.begin(), quals.end());
+
+    int q1Levels = min(symbols, QUALCM_Q1_LEVELS);
+    int q2Levels = min(symbols, QUALCM_Q2_LEVELS);
+    ContextModels models;
+    models.init(contextCount(symbols), symbols);
+    RangeEncoder rc(out);
+
+    const uint8* p = qual;
+    for(int r=0; r<reads; r++) {
+        uint32 rlen = readLens[r];
+        bool reversed = reverseOdd && (r%2 == 1);
+        int q1 = 0;
+        int q2 = 0;
+        for(uint32 i=0; i<rlen; i++) {
+            uint32 cycle = reversed ? rlen - 1 - i : i;
+            int sym = symOfQual[p[i]];
+            models.encode(rc, QUALCM_CONTEXT(cycle, q1, q2), sym);
+            q2 = q1;
+            q1 = sym;
+        }
+        p += rlen;
+    }
+    rc.finish();
+}
+
+uint32 QualCM::decode(const uint8* in, uint32 inLen, const uint32* readLens, int reads, bool reverseOdd, uint8* out, uint32 outCapacity) {
+    if(inLen < 5)
+        error_exit("QualCM: the encoded data is truncated");
+    uint32 len = (uint32)in[0] | ((uint32)in[1] << 8) | ((uint32)in[2] << 16) | ((uint32)in[3] << 24);
+    int symbols = in[4] + 1;
+    if(inLen < 5 + (uint32)symbols)
+        error_exit("QualCM: the encoded data is truncated");
+    const uint8* quals = in + 5;
+    uint32 total = 0;
+    for(int r=0; r<reads; r++)
+        total += readLens[r];
+    if(len != total || len > outCapacity)
+        error_exit("QualCM: the quality length is inconsistent with the read lengths");
+
+    int q1Levels = min(symbols, QUALCM_Q1_LEVELS);
+    int q2Levels = min(symbols, QUALCM_Q2_LEVELS);
+    ContextModels models;
+    models.init(contextCount(symbols), symbols);
+    const uint8* stream = quals + symbols;
+    uint32 streamLen = inLen - 5 - symbols;
+    RangeDecoder rc(stream, streamLen);
+
+    uint8* p = out;
+    for(int r=0; r<reads; r++) {
+        uint32 rlen = readLens[r];
+        bool reversed = reverseOdd && (r%2 == 1);
+        int q1 = 0;
+        int q2 = 0;
+        for(uint32 i=0; i<rlen; i++) {
+            uint32 cycle = reversed ? rlen - 1 - i : i;
+            int sym = models.decode(rc, QUALCM_CONTEXT(cycle, q1, q2));
+            p[i] = quals[sym];
+            q2 = q1;
+            q1 = sym;
+        }
+        p += rlen;
+    }
+
+    uint32 consumed = rc.consumed(stream);
+    if(consumed > streamLen)
+        error_exit("QualCM: the encoded data is truncated");
+    return 5 + symbols + consumed;
+}
+
+bool QualCM::test() {
+    const char* qual = "FFFF:FFF,FFFF#FF:F,FFFFFFFFFFF:FFFFF,:FFFFFFFFFFFFFFFFF::FFFFF#";
+    vector<string> cases;
+    vector<vector<uint32> > lens;
+
+    // no read
+    cases.push_back("");
+    lens.push_back(vector<uint32>());
+    // an empty read and a single quality
+    cases.push_back("F");
+    lens.push_back(vector<uint32>(1, 0));
+    lens.back().push_back(1);
+    // NovaSeq like reads of different lengths
+    string reads;
+    vector<uint32> readLens;
+    for(int i=0; i<500; i++) {
+        string r = string(qual + (i*7) % 20);
+        reads += r;
+        readLens.push_back(r.length());
+    }
+    cases.push_back(reads);
+    lens.push_back(readLens);
+    // all the 256 qualities, in a long read for the binned cycles
+    string allBytes;
+    for(int i=0; i<256*3; i++)
+        allBytes += (char)((i * 37) & 0xFF);
+    cases.push_back(allBytes);
+    lens.push_back(vector<uint32>(1, allBytes.length()));
+
+    for(int reverseOdd=0; reverseOdd<=1; reverseOdd++) {
+        for(size_t c=0; c<cases.size(); c++) {
+            const string& data = cases[c];
+            vector<uint8> encoded;
+            encode((const uint8*)data.data(), lens[c].data(), lens[c].size(), reverseOdd, encoded);
+            if(encoded.size() > bound(data.length()))
+                return false;
+            string decoded(data.length(), '\0');
+            uint32 consumed = decode(encoded.data(), encoded.size(), lens[c].data(), lens[c].size(), reverseOdd, (uint8*)&decoded[0], decoded.length());
+            if(consumed != encoded.size() || decoded != data) {
+                cerr << "QualCM::test failed with " << data.length() << " qualities" << endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
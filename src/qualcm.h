@@ -0,0 +1,35 @@
+#ifndef QUALCM_H
+#define QUALCM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "common.h"
+
+using namespace std;
+
+/*
+* a context-model coder of qualities, every quality is range coded by an adaptive model selected by
+* the position in the read (cycle), the previous quality q[-1] and the one before q[-2]
+* the models start from flat frequencies, so every encoded block can be decoded alone
+* the qualities are mapped to the symbols 0..n-1 by the table, and the encoded data is:
+* <len:uint32><symbols-1:uint8>{<quality:uint8>}<range coded stream>
+*/
+class QualCM{
+public:
+    // encode the qualities of the reads, whose lengths are given by readLens, and append the encoded data to out
+    // if reverseOdd is set, the odd reads are stored reversed (the read2 of interleaved PE), so their cycle is counted from the end
+    static void encode(const uint8* qual, const uint32* readLens, int reads, bool reverseOdd, vector<uint8>& out);
+    // decode the data encoded by encode() to out, which has space for the sum of readLens
+    // return the bytes consumed of in
+    static uint32 decode(const uint8* in, uint32 inLen, const uint32* readLens, int reads, bool reverseOdd, uint8* out, uint32 outCapacity);
+    // the max encoded size of len qualities
+    static uint32 bound(uint32 len);
+    static bool test();
+
+private:
+    static int contextCount(int symbols);
+    static int cycleBin(uint32 pos);
+};
+
+#endif
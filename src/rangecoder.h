@@ -0,0 +1,165 @@
+#ifndef RANGECODER_H
+#define RANGECODER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "common.h"
+
+using namespace std;
+
+/*
+* a byte-wise range coder with carry propagation, and the adaptive frequency models used with it
+* the total frequency of a model is kept below 1<<16, so the range never gets too small to code a symbol
+*/
+
+#define RC_TOP (1u<<24)
+
+class RangeEncoder{
+public:
+    RangeEncoder(vector<uint8>& out) : mOut(out) {
+        mLow = 0;
+        mRange = 0xFFFFFFFF;
+        mCache = 0;
+        mCacheSize = 1;
+    }
+
+    inline void encode(uint32 cum, uint32 freq, uint32 total) {
+        mRange /= total;
+        mLow += (uint64)cum * mRange;
+        mRange *= freq;
+        while(mRange < RC_TOP) {
+            mRange <<= 8;
+            shiftLow();
+        }
+    }
+
+    void finish() {
+        for(int i=0; i<5; i++)
+            shiftLow();
+    }
+
+private:
+    inline void shiftLow() {
+        if((uint32)mLow < 0xFF000000u || (mLow >> 32) != 0) {
+            uint8 carry = mLow >> 32;
+            uint8 byte = mCache;
+            do {
+                mOut.push_back(byte + carry);
+                byte = 0xFF;
+            } while(--mCacheSize != 0);
+            mCache = (mLow >> 24) & 0xFF;
+        }
+        mCacheSize++;
+        mLow = (mLow & 0x00FFFFFF) << 8;
+    }
+
+private:
+    vector<uint8>& mOut;
+    uint64 mLow;
+    uint32 mRange;
+    uint8 mCache;
+    uint64 mCacheSize;
+};
+
+class RangeDecoder{
+public:
+    RangeDecoder(const uint8* data, uint32 len) {
+        mData = data;
+        mEnd = data + len;
+        mRange = 0xFFFFFFFF;
+        mCode = 0;
+        for(int i=0; i<5; i++)
+            mCode = (mCode << 8) | nextByte();
+    }
+
+    // get the cumulative frequency of the next symbol, then decode() it
+    inline uint32 getFreq(uint32 total) {
+        mRange /= total;
+        uint32 v = mCode / mRange;
+        return v < total ? v : total - 1;
+    }
+
+    inline void decode(uint32 cum, uint32 freq) {
+        mCode -= cum * mRange;
+        mRange *= freq;
+        while(mRange < RC_TOP) {
+            mCode = (mCode << 8) | nextByte();
+            mRange <<= 8;
+        }
+    }
+
+    // the bytes consumed
+    uint32 consumed(const uint8* start) {
+        return mData - start;
+    }
+
+private:
+    inline uint8 nextByte() {
+        // reading after the end means the data is broken, but 0 is returned to let the caller check the result
+        if(mData < mEnd)
+            return *mData++;
+        mData++;
+        return 0;
+    }
+
+private:
+    const uint8* mData;
+    const uint8* mEnd;
+    uint32 mRange;
+    uint32 mCode;
+};
+
+// a set of adaptive frequency models of the same alphabet (up to 256 symbols), one model per context
+class ContextModels{
+public:
+    void init(int contexts, int symbols) {
+        mSymbols = symbols;
+        mFreqs.assign(contexts * symbols, 1);
+        mTotals.assign(contexts, symbols);
+    }
+
+    inline void encode(RangeEncoder& rc, int ctx, int sym) {
+        uint16* freqs = mFreqs.data() + ctx * mSymbols;
+        uint32 cum = 0;
+        for(int s=0; s<sym; s++)
+            cum += freqs[s];
+        rc.encode(cum, freqs[sym], mTotals[ctx]);
+        update(freqs, mTotals[ctx], sym);
+    }
+
+    inline int decode(RangeDecoder& rc, int ctx) {
+        uint16* freqs = mFreqs.data() + ctx * mSymbols;
+        uint32 target = rc.getFreq(mTotals[ctx]);
+        uint32 cum = 0;
+        int sym = 0;
+        // a broken stream can give a target out of the model
+        while(sym < mSymbols - 1 && cum + freqs[sym] <= target)
+            cum += freqs[sym++];
+        rc.decode(cum, freqs[sym]);
+        update(freqs, mTotals[ctx], sym);
+        return sym;
+    }
+
+private:
+    inline void update(uint16* freqs, uint32& total, int sym) {
+        freqs[sym] += STEP;
+        total += STEP;
+        if(total > MAX_TOTAL) {
+            total = 0;
+            for(int s=0; s<mSymbols; s++) {
+                freqs[s] = (freqs[s] + 1) / 2;
+                total += freqs[s];
+            }
+        }
+    }
+
+private:
+    static const uint32 STEP = 16;
+    static const uint32 MAX_TOTAL = (1<<16) - 256;
+    int mSymbols;
+    vector<uint16> mFreqs;
+    vector<uint32> mTotals;
+};
+
+#endif
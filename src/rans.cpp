@@ -0,0 +1,284 @@
+#include "rans.h"
+#include "util.h"
+#include "endian.h"
+#include <memory.h>
+
+#define RANS_SCALE_BITS 12
+#define RANS_TOTAL_FREQ (1<<RANS_SCALE_BITS)
+#define RANS_MASK (RANS_TOTAL_FREQ - 1)
+// the lower bound of the state, the state is kept in [RANS_L, RANS_L << 8)
+#define RANS_L (1u<<23)
+// <contexts:uint16>, and 256 contexts of <ctx><symbols-1> and 256 <sym><freq:uint16>
+#define RANS_MAX_TABLE_SIZE (2 + 256 * (2 + 256 * 3))
+
+static inline void putUInt32(vector<uint8>& out, uint32 val) {
+    for(int b=0; b<4; b++)
+        out.push_back((val >> (b*8)) & 0xFF);
+}
+
+static inline uint32 getUInt32(const uint8* p) {
+    return (uint32)p[0] | ((uint32)p[1] << 8) | ((uint32)p[2] << 16) | ((uint32)p[3] << 24);
+}
+
+// push a symbol to the state, the bytes are written backwards
+static inline void ransPut(uint32& x, uint8*& ptr, uint32 start, uint32 freq) {
+    uint32 xMax = ((RANS_L >> RANS_SCALE_BITS) << 8) * freq;
+    while(x >= xMax) {
+        *--ptr = x & 0xFF;
+        x >>= 8;
+    }
+    x = ((x / freq) << RANS_SCALE_BITS) + (x % freq) + start;
+}
+
+static inline void ransFlush(uint32 x, uint8*& ptr) {
+    ptr -= 4;
+    ptr[0] = x & 0xFF;
+    ptr[1] = (x >> 8) & 0xFF;
+    ptr[2] = (x >> 16) & 0xFF;
+    ptr[3] = (x >> 24) & 0xFF;
+}
+
+uint32 Rans::bound(uint32 len) {
+    // a symbol costs 12 bits at most
+    return 7 + RANS_MAX_TABLE_SIZE + len + len / 2 + 64;
+}
+
+void Rans::normalize(const uint32* counts, uint16* freqs) {
+    uint64 total = 0;
+    for(int s=0; s<256; s++)
+        total += counts[s];
+    memset(freqs, 0, sizeof(uint16)*256);
+    if(total == 0)
+        return;
+
+    int assigned = 0;
+    int maxSym = 0;
+    for(int s=0; s<256; s++) {
+        if(counts[s] == 0)
+            continue;
+        int f = (uint64)counts[s] * RANS_TOTAL_FREQ / total;
+        if(f == 0)
+            f = 1;
+        freqs[s] = f;
+        assigned += f;
+        if(counts[s] > counts[maxSym])
+            maxSym = s;
+    }
+
+    // give the rest to the most frequent symbol, or take the excess from the largest frequencies
+    if(assigned <= RANS_TOTAL_FREQ) {
+        freqs[maxSym] += RANS_TOTAL_FREQ - assigned;
+        return;
+    }
+    while(assigned > RANS_TOTAL_FREQ) {
+        int largest = 0;
+        for(int s=0; s<256; s++) {
+            if(freqs[s] > freqs[largest])
+                largest = s;
+        }
+        int dec = min(assigned - RANS_TOTAL_FREQ, freqs[largest] - 1);
+        // every symbol has the frequency 1, which can't happen with <= 256 symbols
+        if(dec <= 0)
+            error_exit("rANS: failed to normalize the frequencies");
+        freqs[largest] -= dec;
+        assigned -= dec;
+    }
+}
+
+void Rans::encode(const uint8* in, uint32 len, int order, vector<uint8>& out) {
+    uint32 partLen = (len + 3) / 4;
+    int contexts = order == 0 ? 1 : 256;
+
+    // count the symbols of every context
+    vector<uint32> counts(contexts * 256, 0);
+    for(int k=0; k<4; k++) {
+        uint32 start = k * partLen;
+        uint32 end = min(len, start + partLen);
+        uint8 ctx = 0;
+        for(uint32 i=start; i<end; i++) {
+            counts[(order == 0 ? 0 : ctx) * 256 + in[i]]++;
+            ctx = in[i];
+        }
+    }
+
+    vector<uint16> freqs(contexts * 256, 0);
+    vector<uint16> starts(contexts * 256, 0);
+    int usedContexts = 0;
+    for(int c=0; c<contexts; c++) {
+        normalize(counts.data() + c*256, freqs.data() + c*256);
+        uint16 cum = 0;
+        for(int s=0; s<256; s++) {
+            starts[c*256 + s] = cum;
+            cum += freqs[c*256 + s];
+        }
+        if(cum > 0)
+            usedContexts++;
+    }
+
+    putUInt32(out, len);
+    out.push_back(order);
+    out.push_back(usedContexts & 0xFF);
+    out.push_back(usedContexts >> 8);
+    for(int c=0; c<contexts; c++) {
+        const uint16* f = freqs.data() + c*256;
+        int symbols = 0;
+        for(int s=0; s<256; s++) {
+            if(f[s] > 0)
+                symbols++;
+        }
+        if(symbols == 0)
+            continue;
+        out.push_back(c);
+        out.push_back(symbols - 1);
+        for(int s=0; s<256; s++) {
+            if(f[s] == 0)
+                continue;
+            out.push_back(s);
+            out.push_back(f[s] & 0xFF);
+            out.push_back(f[s] >> 8);
+        }
+    }
+
+    // the symbols are pushed backwards, so the decoder can read them forwards
+    vector<uint8> buf(len + len / 2 + 64);
+    uint8* end = buf.data() + buf.size();
+    uint8* ptr = end;
+    uint32 states[4] = {RANS_L, RANS_L, RANS_L, RANS_L};
+    for(int64 j=(int64)partLen-1; j>=0; j--) {
+        for(int k=3; k>=0; k--) {
+            uint32 i = k * partLen + j;
+            if(i >= len)
+                continue;
+            int ctx = (order == 0 || j == 0) ? 0 : in[i-1];
+            uint8 s = in[i];
+            ransPut(states[k], ptr, starts[ctx*256 + s], freqs[ctx*256 + s]);
+        }
+    }
+    for(int k=3; k>=0; k--)
+        ransFlush(states[k], ptr);
+
+    out.insert(out.end(), ptr, end);
+}
+
+uint32 Rans::decodedLength(const uint8* in, uint32 inLen) {
+    if(inLen < 4)
+        error_exit("rANS: the encoded data is truncated");
+    return getUInt32(in);
+}
+
+uint32 Rans::decode(const uint8* in, uint32 inLen, uint8* out, uint32 outCapacity) {
+    const uint8* p = in;
+    const uint8* end = in + inLen;
+    if(inLen < 7)
+        error_exit("rANS: the encoded data is truncated");
+    uint32 len = getUInt32(p);
+    int order = p[4];
+    int usedContexts = p[5] | (p[6] << 8);
+    p += 7;
+    if(len > outCapacity)
+        error_exit("rANS: the decoded data is larger than expected");
+
+    // the decoding table of every used context, which maps the lowest 12 bits of the state to
+    // <sym:8 bits><freq-1:12 bits><the offset in the symbol's range:12 bits>
+    int slotOfCtx[256];
+    for(int c=0; c<256; c++)
+        slotOfCtx[c] = -1;
+    vector<uint32> table(usedContexts * RANS_TOTAL_FREQ, 0);
+    uint16 f[256];
+    for(int slot=0; slot<usedContexts; slot++) {
+        if(p + 2 > end)
+            error_exit("rANS: the frequency table is truncated");
+        int ctx = p[0];
+        int symbols = p[1] + 1;
+        p += 2;
+        if(p + symbols * 3 > end)
+            error_exit("rANS: the frequency table is truncated");
+        slotOfCtx[ctx] = slot * RANS_TOTAL_FREQ;
+        memset(f, 0, sizeof(uint16)*256);
+        for(int i=0; i<symbols; i++) {
+            f[p[0]] = p[1] | (p[2] << 8);
+            p += 3;
+        }
+        uint32 cum = 0;
+        uint32* t = table.data() + slot * RANS_TOTAL_FREQ;
+        for(int s=0; s<256; s++) {
+            if(f[s] == 0)
+                continue;
+            if(cum + f[s] > RANS_TOTAL_FREQ)
+                error_exit("rANS: bad frequency table");
+            for(uint32 j=0; j<f[s]; j++)
+                t[cum + j] = s | ((uint32)(f[s] - 1) << 8) | (j << 20);
+            cum += f[s];
+        }
+    }
+
+    if(p + 16 > end)
+        error_exit("rANS: the encoded data is truncated");
+    uint32 states[4];
+    for(int k=0; k<4; k++) {
+        states[k] = getUInt32(p);
+        p += 4;
+    }
+
+    uint32 partLen = (len + 3) / 4;
+    for(uint32 j=0; j<partLen; j++) {
+        for(int k=0; k<4; k++) {
+            uint32 i = k * partLen + j;
+            if(i >= len)
+                continue;
+            int ctx = (order == 0 || j == 0) ? 0 : out[i-1];
+            int base = slotOfCtx[ctx];
+            if(base < 0)
+                error_exit("rANS: unknown context");
+            uint32 x = states[k];
+            uint32 entry = table[base + (x & RANS_MASK)];
+            out[i] = entry & 0xFF;
+            x = (((entry >> 8) & RANS_MASK) + 1) * (x >> RANS_SCALE_BITS) + (entry >> 20);
+            while(x < RANS_L) {
+                if(p >= end)
+                    error_exit("rANS: the encoded data is truncated");
+                x = (x << 8) | *p++;
+            }
+            states[k] = x;
+        }
+    }
+
+    return p - in;
+}
+
+bool Rans::test() {
+    // qualities like NovaSeq, and some edge cases
+    const char* qual = "FFFF:FFF,FFFF#FF:F,FFFFFFFFFFF:FFFFF,:FFFFFFFFFFFFFFFFF::FFFFF#";
+    vector<string> cases;
+    cases.push_back("");
+    cases.push_back("F");
+    cases.push_back("FF:");
+    cases.push_back(string(1000, 'F'));
+    string longQual;
+    for(int i=0; i<300; i++)
+        longQual += string(qual + (i*7) % 20);
+    cases.push_back(longQual);
+    string allBytes;
+    for(int i=0; i<256*3; i++)
+        allBytes += (char)((i * 37) & 0xFF);
+    cases.push_back(allBytes);
+
+    for(int order=0; order<=1; order++) {
+        for(size_t c=0; c<cases.size(); c++) {
+            const string& data = cases[c];
+            vector<uint8> encoded;
+            encode((const uint8*)data.data(), data.length(), order, encoded);
+            if(encoded.size() > bound(data.length()))
+                return false;
+            if(decodedLength(encoded.data(), encoded.size()) != data.length())
+                return false;
+            string decoded(data.length(), '\0');
+            uint32 consumed = decode(encoded.data(), encoded.size(), (uint8*)&decoded[0], decoded.length());
+            if(consumed != encoded.size() || decoded != data) {
+                cerr << "Rans::test failed with order " << order << " and " << data.length() << " bytes" << endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,35 @@
+#ifndef RANS_H
+#define RANS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "common.h"
+
+using namespace std;
+
+/*
+* a byte-wise rANS entropy coder with 12-bit frequencies and 4 interleaved states
+* the input is split into 4 parts, and each part is coded by its own state, so the decoder can work on them together
+* order 0 codes every byte with one frequency table, and order 1 uses the previous byte of the same part as the context
+* the encoded data is:
+* <len:uint32><order:uint8><contexts:uint16>{<ctx:uint8><symbols-1:uint8>{<sym:uint8><freq:uint16>}}<4 states><stream>
+*/
+class Rans{
+public:
+    // encode len bytes of in, and append the encoded data to out
+    static void encode(const uint8* in, uint32 len, int order, vector<uint8>& out);
+    // decode the data encoded by encode() to out, which has space for the decoded length
+    // return the bytes consumed of in
+    static uint32 decode(const uint8* in, uint32 inLen, uint8* out, uint32 outCapacity);
+    // the decoded length of encoded data
+    static uint32 decodedLength(const uint8* in, uint32 inLen);
+    // the max encoded size of len bytes
+    static uint32 bound(uint32 len);
+    static bool test();
+
+private:
+    static void normalize(const uint32* counts, uint16* freqs);
+};
+
+#endif
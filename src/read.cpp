@@ -1,6 +1,7 @@
 #include "read.h"
 #include <sstream>
 #include "util.h"
+#include "simd.h"
 
 Read::Read(string name, string seq, string strand, string quality, bool phred64){
 	mName = name;
@@ -37,7 +38,7 @@ Read::Read(string name, Sequence seq, string strand){
 }
 
 void Read::convertPhred64To33(){
-	for(int i=0; i<mQuality.length(); i++) {
+	for(size_t i=0; i<mQuality.length(); i++) {
 		mQuality[i] = max(33, mQuality[i] - (64-33));
 	}
 }
@@ -76,42 +77,8 @@ Read* Read::reverseComplement(){
 
 void Read::changeToReverseComplement() {
 	int len = length();
-	for(int i=0; i<len/2; i++) {
-		// swap quality
-		char tmp = mQuality[i];
-		mQuality[i] = mQuality[len-i-1];
-		mQuality[len-i-1] = tmp;
-
-		// swap seq
-		tmp = mSeq.mStr[i];
-		mSeq.mStr[i] = mSeq.mStr[len-i-1];
-		mSeq.mStr[len-i-1] = tmp;
-	}
-
-	// make complement
-	for(int c=0;c<len;c++){
-        char base = mSeq.mStr[c];
-        switch(base){
-            case 'A':
-            case 'a':
-                mSeq.mStr[c] = 'T';
-                break;
-            case 'T':
-            case 't':
-                mSeq.mStr[c] = 'A';
-                break;
-            case 'C':
-            case 'c':
-                mSeq.mStr[c] = 'G';
-                break;
-            case 'G':
-            case 'g':
-                mSeq.mStr[c] = 'C';
-                break;
-            default:
-                mSeq.mStr[c] = 'N';
-        }
-    }
+	char* qual = mQuality.length() == (size_t)len ? &mQuality[0] : NULL;
+	::reverseComplement(&mSeq.mStr[0], qual, len);
 }
 
 void Read::resize(int len) {
@@ -156,7 +123,7 @@ string Read::firstIndex(){
 
 int Read::lowQualCount(int qual){
 	int count = 0;
-	for(int q=0;q<mQuality.size();q++){
+	for(size_t q=0;q<mQuality.size();q++){
 		if(mQuality[q] < qual + 33)
 			count++;
 	}
@@ -0,0 +1,119 @@
+#include "readbatch.h"
+#include "util.h"
+#include "simd.h"
+#include <string.h>
+
+ReadBatch::ReadBatch() {
+    mPaired = false;
+    clear();
+}
+
+void ReadBatch::clear() {
+    mNames.clear();
+    mSeqs.clear();
+    mQuals.clear();
+    mStrands.clear();
+    mNameStarts.clear();
+    mSeqStarts.clear();
+    mStrandStarts.clear();
+    mNameStarts.push_back(0);
+    mSeqStarts.push_back(0);
+    mStrandStarts.push_back(0);
+}
+
+void ReadBatch::append(const FastqRecord& rec, bool phred64) {
+    mNames.insert(mNames.end(), rec.name, rec.name + rec.nameLen);
+    mSeqs.insert(mSeqs.end(), rec.seq, rec.seq + rec.seqLen);
+    mStrands.insert(mStrands.end(), rec.strand, rec.strand + rec.strandLen);
+    if(rec.qual == NULL) {
+        mQuals.resize(mQuals.size() + rec.seqLen, 'K');
+    } else {
+        // keep the qualities aligned with the bases even if the record is malformed
+        int qualLen = min(rec.qualLen, rec.seqLen);
+        mQuals.insert(mQuals.end(), rec.qual, rec.qual + qualLen);
+        if(qualLen < rec.seqLen)
+            mQuals.resize(mQuals.size() + rec.seqLen - qualLen, '\0');
+        if(phred64) {
+            char* q = &mQuals[mQuals.size() - rec.seqLen];
+            for(int i=0; i<qualLen; i++)
+                q[i] = max(33, q[i] - (64-33));
+        }
+    }
+    mNameStarts.push_back(mNames.size());
+    mSeqStarts.push_back(mSeqs.size());
+    mStrandStarts.push_back(mStrands.size());
+}
+
+void ReadBatch::append(Read* r) {
+    FastqRecord rec;
+    rec.name = r->mName.c_str();
+    rec.nameLen = r->mName.length();
+    rec.seq = r->mSeq.mStr.c_str();
+    rec.seqLen = r->mSeq.mStr.length();
+    rec.strand = r->mStrand.c_str();
+    rec.strandLen = r->mStrand.length();
+    rec.qual = r->mQuality.c_str();
+    rec.qualLen = r->mQuality.length();
+    append(rec);
+}
+
+void ReadBatch::removeLast() {
+    if(size() == 0)
+        return;
+    mNameStarts.pop_back();
+    mSeqStarts.pop_back();
+    mStrandStarts.pop_back();
+    mNames.resize(mNameStarts.back());
+    mSeqs.resize(mSeqStarts.back());
+    mQuals.resize(mSeqStarts.back());
+    mStrands.resize(mStrandStarts.back());
+}
+
+int ReadBatch::size() {
+    return mSeqStarts.size() - 1;
+}
+
+uint32 ReadBatch::totalBases() {
+    return mSeqs.size();
+}
+
+string ReadBatch::nameStr(int i) {
+    return string(name(i), nameLen(i));
+}
+
+string ReadBatch::strandStr(int i) {
+    return string(strand(i), strandLen(i));
+}
+
+void ReadBatch::reverseComplement(int i) {
+    ::reverseComplement(seq(i), qual(i), length(i));
+}
+
+Read* ReadBatch::toRead(int i) {
+    return new Read(nameStr(i), string(seq(i), length(i)), strandStr(i), string(qual(i), length(i)));
+}
+
+bool ReadBatch::test() {
+    Read r1("@A00251:28:H3YV7DSXX:4:1101:2356:1000 1:N:0:TAAGTGGC", "ACGTNAACC", "+", "FF:F#FF,F");
+    Read r2("@A00251:28:H3YV7DSXX:4:1101:2356:1000 2:N:0:TAAGTGGC", "TTGCA", "+", ",FFF:");
+    ReadBatch batch;
+    // the second pass reuses the arenas
+    for(int pass=0; pass<2; pass++) {
+        batch.clear();
+        batch.append(&r1);
+        batch.append(&r2);
+        if(batch.size() != 2 || batch.totalBases() != 14)
+            return false;
+        Read* b = batch.toRead(1);
+        bool same = b->mName == r2.mName && b->mSeq.mStr == r2.mSeq.mStr && b->mStrand == r2.mStrand && b->mQuality == r2.mQuality;
+        delete b;
+        if(!same)
+            return false;
+    }
+    batch.reverseComplement(0);
+    if(string(batch.seq(0), batch.length(0)) != "GGTTNACGT" || string(batch.qual(0), batch.length(0)) != "F,FF#F:FF") {
+        cerr << "reverseComplement() is wrong: " << string(batch.seq(0), batch.length(0)) << endl;
+        return false;
+    }
+    return true;
+}
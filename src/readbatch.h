@@ -0,0 +1,62 @@
+#ifndef READ_BATCH_H
+#define READ_BATCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "common.h"
+#include "read.h"
+#include "fastqreader.h"
+
+using namespace std;
+
+/*
+* a chunk of reads stored as structure-of-arrays
+* the names, sequences, strands and qualities are copied into contiguous arenas and located by offsets
+* clear() keeps the memory, so a batch can be refilled for the next chunk without allocation
+* for paired-end data, read1 and read2 are interleaved, so the reads 0, 2, 4... are read1
+*/
+class ReadBatch{
+public:
+    ReadBatch();
+    void clear();
+    // copy a parsed record into the arenas, a record without quality gets 'K' for all bases
+    void append(const FastqRecord& rec, bool phred64 = false);
+    void append(Read* r);
+    // drop the last read, i.e. read1 of an incomplete pair
+    void removeLast();
+    int size();
+    uint32 totalBases();
+
+    inline const char* name(int i) { return &mNames[mNameStarts[i]]; }
+    inline int nameLen(int i) { return mNameStarts[i+1] - mNameStarts[i]; }
+    inline char* seq(int i) { return &mSeqs[mSeqStarts[i]]; }
+    inline char* qual(int i) { return &mQuals[mSeqStarts[i]]; }
+    inline int length(int i) { return mSeqStarts[i+1] - mSeqStarts[i]; }
+    inline const char* strand(int i) { return &mStrands[mStrandStarts[i]]; }
+    inline int strandLen(int i) { return mStrandStarts[i+1] - mStrandStarts[i]; }
+
+    string nameStr(int i);
+    string strandStr(int i);
+    // make the read i reverse complement in place
+    void reverseComplement(int i);
+    Read* toRead(int i);
+
+    static bool test();
+
+public:
+    bool mPaired;
+
+private:
+    vector<char> mNames;
+    vector<char> mSeqs;
+    vector<char> mQuals;
+    vector<char> mStrands;
+    // the read i is in [starts[i], starts[i+1]), the sequence and quality share the same offsets
+    vector<uint32> mNameStarts;
+    vector<uint32> mSeqStarts;
+    vector<uint32> mStrandStarts;
+};
+
+#endif
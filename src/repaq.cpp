@@ -2,8 +2,15 @@
 #include "fastqreader.h"
 #include "util.h"
 #include "writer.h"
+#include "pipeline.h"
+#include "rfqindex.h"
+#include "rfqreader.h"
+#include "endian.h"
+#include <memory.h>
 #include <stdio.h>
 #include <sstream>
+#include <thread>
+#include <atomic>
 
 Repaq::Repaq(Options* opt){
     mOptions = opt;
@@ -34,202 +41,240 @@ void Repaq::run() {
 }
 
 void Repaq::compare(){
-    RfqCodec codec;
-
-    ifstream input;
-    input.open(mOptions->rfqCompare, ios::in | ios::binary);
-
     FastqReader reader(mOptions->in1);
+    comparePipeline(&reader, NULL);
+}
 
-    RfqHeader* header = new RfqHeader();
-    header->read(input);
+void Repaq::comparePE(){
+    FastqReaderPair reader(mOptions->in1, mOptions->in2);
+    comparePipeline(NULL, &reader);
+}
 
-    codec.setHeader(header);
+/*
+* one thread reads the RFQ chunks, a pool of workers decodes them,
+* one thread parses the FASTQ into batches that match the decoded chunks,
+* and a pool of workers compares each chunk with its batch
+* the calling thread collects the comparison results in order, so the first difference is reported
+*/
+void Repaq::comparePipeline(FastqReader* reader, FastqReaderPair* pairReader) {
+    bool isPE = pairReader != NULL;
+
+    RfqReader rfq(mOptions->rfqCompare);
+    RfqHeader* header = rfq.header();
+
+    int threadNum = mOptions->threadNum;
+    TaskQueue<CompareTask*> decodeQueue(threadNum * 2);
+    ReorderBuffer<CompareTask*> decodedBuffer(threadNum * 4);
+    TaskQueue<CompareTask*> compareQueue(threadNum * 2);
+    ReorderBuffer<CompareTask*> resultBuffer(threadNum * 4);
+
+    // set when a difference is found, to stop reading more data
+    atomic_bool stopped(false);
+    bool fastqHasMore = false;
+
+    thread rfqReader([&]{
+        long id = 0;
+        while(!stopped) {
+            RfqChunk* chunk = rfq.next();
+            if(chunk == NULL)
+                break;
+            CompareTask* task = new CompareTask();
+            task->id = id;
+            task->chunk = chunk;
+            decodeQueue.push(task);
+            id++;
+        }
+        decodeQueue.close();
+        decodedBuffer.finish(id);
+    });
+
+    vector<thread> decoders;
+    for(int t=0; t<threadNum; t++) {
+        decoders.push_back(thread([&]{
+            RfqCodec codec;
+            codec.setHeader(header);
+            CompareTask* task = NULL;
+            while(decodeQueue.pop(task)) {
+                if(!stopped)
+                    task->decoded = codec.decodeChunk(task->chunk);
+                delete task->chunk;
+                task->chunk = NULL;
+                decodedBuffer.put(task->id, task);
+            }
+        }));
+    }
+
+    thread fastqParser([&]{
+        long id = 0;
+        CompareTask* task = NULL;
+        while(decodedBuffer.next(task)) {
+            // read as many FASTQ reads as the decoded chunk has, PE reads are interleaved like the RFQ
+            while(!stopped && task->original.size() < task->decoded.size()) {
+                if(isPE) {
+                    ReadPair* pair = pairReader->read();
+                    if(!pair)
+                        break;
+                    task->original.push_back(pair->mLeft);
+                    task->original.push_back(pair->mRight);
+                    pair->mLeft = NULL;
+                    pair->mRight = NULL;
+                    delete pair;
+                } else {
+                    Read* read = reader->read();
+                    if(!read)
+                        break;
+                    task->original.push_back(read);
+                }
+            }
+            compareQueue.push(task);
+            id++;
+        }
+        if(!stopped) {
+            if(isPE) {
+                ReadPair* pair = pairReader->read();
+                fastqHasMore = pair != NULL;
+                if(pair)
+                    delete pair;
+            } else {
+                Read* read = reader->read();
+                fastqHasMore = read != NULL;
+                if(read)
+                    delete read;
+            }
+        }
+        compareQueue.close();
+        resultBuffer.finish(id);
+    });
+
+    vector<thread> comparers;
+    for(int t=0; t<threadNum; t++) {
+        comparers.push_back(thread([&]{
+            CompareTask* task = NULL;
+            while(compareQueue.pop(task)) {
+                if(!stopped)
+                    compareReads(task);
+                resultBuffer.put(task->id, task);
+            }
+        }));
+    }
 
     long fqReads = 0;
     long fqBases = 0;
     long rfqReads = 0;
     long rfqBases = 0;
-
-    RfqChunk* chunk = NULL;
-    while(!input.eof() || chunk != NULL) {
-        if(!chunk) {
-            chunk = new RfqChunk(header);
-            chunk->read(input);
-        }
-        vector<Read*> reads = codec.decodeChunk(chunk);
-        if(reads.size() == 0) {
-            delete chunk;
-            chunk = NULL;
-            break;
+    bool failed = false;
+    CompareTask* task = NULL;
+    while(resultBuffer.next(task)) {
+        if(!failed) {
+            rfqReads += task->rfqReads;
+            rfqBases += task->rfqBases;
+            fqReads += task->fqReads;
+            fqBases += task->fqBases;
+            if(task->result != COMPARE_PASSED) {
+                failed = true;
+                stopped = true;
+                reportCompareResult(false, compareFailureMessage(task, isPE, fqReads, rfqReads), fqReads, fqBases, rfqReads, rfqBases);
+            }
         }
+        for(size_t r=0; r<task->decoded.size(); r++)
+            delete task->decoded[r];
+        for(size_t r=0; r<task->original.size(); r++)
+            delete task->original[r];
+        delete task;
+    }
 
-        for(int r=0; r<reads.size(); r++) {
-            Read* rfq = reads[r];
-            rfqBases += rfq->length();
-            rfqReads++;
-
-            Read* fq = reader.read();
-            if(!fq) {
-                string msg = "The RFQ file has more reads than the FASTQ file.";
-                msg += " The RFQ file has >= " + to_string(rfqReads);
-                msg += " reads, while the FASTQ file only has " + to_string(fqReads) + " reads";
-                reportCompareResult(false, msg, fqReads, fqBases, rfqReads, rfqBases);
-                return;
-            }
+    rfqReader.join();
+    for(size_t t=0; t<decoders.size(); t++)
+        decoders[t].join();
+    fastqParser.join();
+    for(size_t t=0; t<comparers.size(); t++)
+        comparers[t].join();
 
+    if(!failed) {
+        if(fastqHasMore) {
             fqReads++;
-            fqBases+=fq->length();
-
-            //check read
-            if(rfq->mName != fq->mName) {
-                string msg = "The RFQ file and FASTQ file have different name in the " + to_string(rfqReads) + " read. ";
-                msg += rfq->mName + " | " + fq->mName;
-                reportCompareResult(false, msg, fqReads, fqBases, rfqReads, rfqBases);
-                return;
-            }
-            else if(rfq->mSeq.mStr != fq->mSeq.mStr) {
-                string msg = "The RFQ file and FASTQ file have different sequence in the " + to_string(rfqReads) + " read. ";
-                msg += rfq->mSeq.mStr + " | " + fq->mSeq.mStr;
-                reportCompareResult(false, msg, fqReads, fqBases, rfqReads, rfqBases);
-                return;
-            }
-            else if(rfq->mStrand != fq->mStrand) {
-                string msg = "The RFQ file and FASTQ file have different strand in the " + to_string(rfqReads) + " read. ";
-                msg += rfq->mStrand + " | " + fq->mStrand;
-                reportCompareResult(false, msg, fqReads, fqBases, rfqReads, rfqBases);
-                return;
-            }
-            else if(rfq->mQuality != fq->mQuality) {
-                string msg = "The RFQ file and FASTQ file have different quality in the " + to_string(rfqReads) + " read. ";
-                msg += rfq->mQuality + " | " + fq->mQuality;
-                reportCompareResult(false, msg, fqReads, fqBases, rfqReads, rfqBases);
-                return;
+            string msg = "The FASTQ file has more reads than the RFQ file.";
+            if(isPE) {
+                msg += " The FASTQ file has >= " + to_string(fqReads/2);
+                msg += " pairs, while the RFQ file only has " + to_string(rfqReads/2) + " pairs";
+            } else {
+                msg += " The FASTQ file has >= " + to_string(fqReads);
+                msg += " reads, while the RFQ file only has " + to_string(rfqReads) + " reads";
             }
-
-            delete rfq;
-            delete fq;
+            reportCompareResult(false, msg, fqReads, fqBases, rfqReads, rfqBases);
+        } else {
+            reportCompareResult(true, "", fqReads, fqBases, rfqReads, rfqBases);
         }
-
-        delete chunk;
-        chunk = NULL;
     }
-
-    if(reader.read()) {
-        fqReads++;
-        string msg = "The FASTQ file has more reads than the RFQ file.";
-        msg += " The FASTQ file has >= " + to_string(fqReads);
-        msg += " reads, while the RFQ file only has " + to_string(rfqReads) + " reads";
-        reportCompareResult(false, msg, fqReads, fqBases, rfqReads, rfqBases);
-        return;
-    }
-
-    reportCompareResult(true, "", fqReads, fqBases, rfqReads, rfqBases);
 }
 
-void Repaq::comparePE(){
-    RfqCodec codec;
-
-    ifstream input;
-    input.open(mOptions->rfqCompare, ios::in | ios::binary);
+// compare the decoded reads with the original reads, and stop at the first difference
+void Repaq::compareReads(CompareTask* task) {
+    for(size_t r=0; r<task->decoded.size(); r++) {
+        Read* rfq = task->decoded[r];
+        task->rfqBases += rfq->length();
+        task->rfqReads++;
 
-    FastqReaderPair reader(mOptions->in1, mOptions->in2);
-
-    RfqHeader* header = new RfqHeader();
-    header->read(input);
+        if(r >= task->original.size()) {
+            task->result = COMPARE_MORE_RFQ_READS;
+            return;
+        }
 
-    codec.setHeader(header);
+        Read* fq = task->original[r];
+        task->fqReads++;
+        task->fqBases += fq->length();
 
-    long fqReads = 0;
-    long fqBases = 0;
-    long rfqReads = 0;
-    long rfqBases = 0;
-
-    RfqChunk* chunk = NULL;
-    while(!input.eof() || chunk != NULL) {
-        if(!chunk) {
-            chunk = new RfqChunk(header);
-            chunk->read(input);
+        if(rfq->mName != fq->mName) {
+            task->result = COMPARE_DIFFERENT_NAME;
+            task->detail = rfq->mName + " | " + fq->mName;
+            return;
         }
-        vector<Read*> reads = codec.decodeChunk(chunk);
-        if(reads.size() == 0) {
-            delete chunk;
-            chunk = NULL;
-            break;
+        else if(rfq->mSeq.mStr != fq->mSeq.mStr) {
+            task->result = COMPARE_DIFFERENT_SEQ;
+            task->detail = rfq->mSeq.mStr + " | " + fq->mSeq.mStr;
+            return;
         }
-
-        ReadPair* pair=NULL;
-        for(int r=0; r<reads.size(); r++) {
-            Read* rfq = reads[r];
-            rfqBases += rfq->length();
-            rfqReads++;
-
-            if(pair == NULL)
-                pair = reader.read();
-            if(!pair) {
-                string msg = "The RFQ file has more reads than the FASTQ file.";
-                msg += " The RFQ file has >= " + to_string(rfqReads/2);
-                msg += " pairs, while the FASTQ file only has " + to_string(fqReads/2) + " pairs";
-                reportCompareResult(false, msg, fqReads, fqBases, rfqReads, rfqBases);
-                return;
-            }
-
-            Read* fq;
-            if(rfqReads%2==1)
-                fq = pair->mLeft;
-            else
-                fq = pair->mRight;
-
-            fqReads++;
-            fqBases+=fq->length();
-
-            //check read
-            if(rfq->mName != fq->mName) {
-                string msg = "The RFQ file and FASTQ file have different name in the " + to_string(rfqReads/2) + " pair. ";
-                msg += rfq->mName + " | " + fq->mName;
-                reportCompareResult(false, msg, fqReads, fqBases, rfqReads, rfqBases);
-                return;
-            }
-            else if(rfq->mSeq.mStr != fq->mSeq.mStr) {
-                string msg = "The RFQ file and FASTQ file have different sequence in the " + to_string(rfqReads/2) + " pair. ";
-                msg += rfq->mSeq.mStr + " | " + fq->mSeq.mStr;
-                reportCompareResult(false, msg, fqReads, fqBases, rfqReads, rfqBases);
-                return;
-            }
-            else if(rfq->mStrand != fq->mStrand) {
-                string msg = "The RFQ file and FASTQ file have different strand in the " + to_string(rfqReads/2) + " pair. ";
-                msg += rfq->mStrand + " | " + fq->mStrand;
-                reportCompareResult(false, msg, fqReads, fqBases, rfqReads, rfqBases);
-                return;
-            }
-            else if(rfq->mQuality != fq->mQuality) {
-                string msg = "The RFQ file and FASTQ file have different quality in the " + to_string(rfqReads/2) + " pair. ";
-                msg += rfq->mQuality + " | " + fq->mQuality;
-                reportCompareResult(false, msg, fqReads, fqBases, rfqReads, rfqBases);
-                return;
-            }
-
-            delete rfq;
-            if(rfqReads%2==0) {
-                delete pair;
-                pair = NULL;
-            }
+        else if(rfq->mStrand != fq->mStrand) {
+            task->result = COMPARE_DIFFERENT_STRAND;
+            task->detail = rfq->mStrand + " | " + fq->mStrand;
+            return;
+        }
+        else if(rfq->mQuality != fq->mQuality) {
+            task->result = COMPARE_DIFFERENT_QUAL;
+            task->detail = rfq->mQuality + " | " + fq->mQuality;
+            return;
         }
-
-        delete chunk;
-        chunk = NULL;
     }
+}
 
-    if(reader.read()) {
-        fqReads++;
-        string msg = "The FASTQ file has more reads than the RFQ file.";
-        msg += " The FASTQ file has >= " + to_string(fqReads/2);
-        msg += " pairs, while the RFQ file only has " + to_string(rfqReads/2) + " pairs";
-        reportCompareResult(false, msg, fqReads, fqBases, rfqReads, rfqBases);
-        return;
+string Repaq::compareFailureMessage(CompareTask* task, bool isPE, long fqReads, long rfqReads) {
+    string msg;
+    if(task->result == COMPARE_MORE_RFQ_READS) {
+        msg = "The RFQ file has more reads than the FASTQ file.";
+        if(isPE) {
+            msg += " The RFQ file has >= " + to_string(rfqReads/2);
+            msg += " pairs, while the FASTQ file only has " + to_string(fqReads/2) + " pairs";
+        } else {
+            msg += " The RFQ file has >= " + to_string(rfqReads);
+            msg += " reads, while the FASTQ file only has " + to_string(fqReads) + " reads";
+        }
+        return msg;
     }
 
-    reportCompareResult(true, "", fqReads, fqBases, rfqReads, rfqBases);
+    string field;
+    switch(task->result) {
+        case COMPARE_DIFFERENT_NAME: field = "name"; break;
+        case COMPARE_DIFFERENT_SEQ: field = "sequence"; break;
+        case COMPARE_DIFFERENT_STRAND: field = "strand"; break;
+        case COMPARE_DIFFERENT_QUAL: field = "quality"; break;
+        default: break;
+    }
+    if(isPE)
+        msg = "The RFQ file and FASTQ file have different " + field + " in the " + to_string(rfqReads/2) + " pair. ";
+    else
+        msg = "The RFQ file and FASTQ file have different " + field + " in the " + to_string(rfqReads) + " read. ";
+    msg += task->detail;
+    return msg;
 }
 
 void Repaq::reportCompareResult(bool passed, string msg, long fqReads, long fqBases, long rfqReads, long rfqBases) {
@@ -260,160 +305,220 @@ void Repaq::reportCompareResult(bool passed, string msg, long fqReads, long fqBa
 
 
 void Repaq::decompress(){
-    RfqCodec codec;
+    if(mOptions->rangeMode)
+        decompressRange(false);
+    else
+        decompressPipeline(false);
+}
+
+void Repaq::decompressPE(){
+    if(mOptions->rangeMode)
+        decompressRange(true);
+    else
+        decompressPipeline(true);
+}
 
+// the position after skipping n FASTQ records in the text from pos
+static size_t skipRecords(const string& text, size_t pos, long n) {
+    for(long l=0; l<n*4 && pos < text.length(); l++) {
+        size_t end = text.find('\n', pos);
+        if(end == string::npos)
+            return text.length();
+        pos = end + 1;
+    }
+    return pos;
+}
+
+/*
+* only decode the chunks overlapping the read range
+* if the RFQ has an index, seek to the first chunk directly,
+* otherwise the earlier chunks are skipped by their sizes (ALGORITHM_VER >= 3) or parsed without decoding
+*/
+void Repaq::decompressRange(bool isPE) {
     ifstream input;
     input.open(mOptions->in1, ios::in | ios::binary);
 
-    Writer writer(mOptions->out1);
-
     RfqHeader* header = new RfqHeader();
     header->read(input);
 
-    /*if(header->mFlags & BIT_PAIRED_END) {
-        error_exit("The input RFQ file was encoded by paired-end FASTQ, you should specify <out1> and <out2>");
-    }*/
+    if(isPE && (header->mFlags & BIT_PAIRED_END) == false) {
+        error_exit("The input RFQ file was encoded by single-end FASTQ, you should not specify <out2>");
+    }
 
-    codec.setHeader(header);
+    // the chunks store the paired-end reads interleaved, so a pair is 2 reads
+    bool pairedEnd = header->mFlags & BIT_PAIRED_END;
+    int readsPerRecord = pairedEnd ? 2 : 1;
+    uint64 first = mOptions->rangeStart * readsPerRecord;
+    uint64 last = first + mOptions->rangeCount * readsPerRecord;
 
-    bool hasNoLineBreakAtEnd = true;
+    Writer writer1(mOptions->out1);
+    Writer* writer2 = NULL;
+    if(isPE)
+        writer2 = new Writer(mOptions->out2);
+
+    uint64 chunkFirstRead = 0;
+    RfqIndex index;
+    if(mOptions->in1 != "/dev/stdin" && index.read(input)) {
+        int c = index.findChunk(first);
+        if(c >= 0) {
+            input.seekg(index.mEntries[c].offset);
+            chunkFirstRead = index.mEntries[c].firstRead;
+        } else {
+            // out of range, nothing to decode
+            chunkFirstRead = last;
+        }
+    }
 
-    RfqChunk* chunk = NULL;
-    while(!input.eof() || chunk != NULL) {
-        if(!chunk) {
-            chunk = new RfqChunk(header);
+    RfqCodec codec;
+    codec.setHeader(header);
+    string out1;
+    string out2;
+    // the chunk loaded into memory, which is parsed in place, so it must outlive the chunk
+    vector<char> data;
+    while(chunkFirstRead < last && !input.eof()) {
+        RfqChunk* chunk = new RfqChunk(header);
+        if(header->mAlgorithmVersion >= 3) {
+            // the exact chunk size is known, so the chunks before the range are not even parsed
+            // the chunk is loaded into memory to be parsed, so the input is never seeked back, and can be STDIN
+            uint32 size = readLittleEndian32(input);
+            uint32 reads = readLittleEndian32(input);
+            if(size < 8 || reads == 0) {
+                delete chunk;
+                break;
+            }
+            if(chunkFirstRead + reads <= first) {
+                input.ignore(size - 8);
+                if((uint32)input.gcount() != size - 8)
+                    error_exit("the RFQ chunk is truncated, the file may be incomplete");
+                chunkFirstRead += reads;
+                delete chunk;
+                continue;
+            }
+            data.resize(size);
+            uint32 sizeLE = adaptToLittleEndian(size);
+            uint32 readsLE = adaptToLittleEndian(reads);
+            memcpy(&data[0], &sizeLE, 4);
+            memcpy(&data[4], &readsLE, 4);
+            input.read(&data[8], size - 8);
+            if((uint32)input.gcount() != size - 8)
+                error_exit("the RFQ chunk is truncated, the file may be incomplete");
+            chunk->parse(data.data(), data.size());
+        } else {
             chunk->read(input);
         }
-        vector<Read*> reads = codec.decodeChunk(chunk);
-        if(reads.size() == 0) {
+        if(chunk->mReads == 0) {
             delete chunk;
-            chunk = NULL;
             break;
         }
-
-        string outstr;
-
-        for(int r=0; r<reads.size(); r++) {
-            outstr += reads[r]->toString();
-            delete reads[r];
-        }
-
-        bool isLastOne = false;
-        bool hasNoLineBreakAtEnd = chunk->mFlags & BIT_HAS_NO_LINE_BREAK_AT_END;
-
-        if(hasNoLineBreakAtEnd) {
-            delete chunk;
-            chunk = NULL;
-            isLastOne = input.eof();
-            // eof sometime doesn't work, we need to check the last chunk to see if it's valid
-            if(!isLastOne) {
-                chunk = new RfqChunk(header);
-                chunk->read(input);
-                isLastOne = chunk->mReads == 0;
-            }
-        }
-
-        // if it's last chunk, we should check the last line break
-        if(hasNoLineBreakAtEnd ) {
-            if(isLastOne) {
-                string nobreak = outstr.substr(0, outstr.length()-1);
-                writer.writeString(nobreak);
-                break;
+        uint64 chunkLastRead = chunkFirstRead + chunk->mReads;
+        if(chunkLastRead > first) {
+            out1.clear();
+            out2.clear();
+            codec.decodeChunk(chunk, out1, isPE ? &out2 : NULL);
+            // the records of this chunk to be written, in the unit of reads stored
+            uint64 from = max(first, chunkFirstRead) - chunkFirstRead;
+            uint64 to = min(last, chunkLastRead) - chunkFirstRead;
+            if(isPE) {
+                size_t start = skipRecords(out1, 0, from/2);
+                size_t end = skipRecords(out1, start, (to - from)/2);
+                writer1.write(&out1[0] + start, end - start);
+                start = skipRecords(out2, 0, from/2);
+                end = skipRecords(out2, start, (to - from)/2);
+                writer2->write(&out2[0] + start, end - start);
             } else {
-                writer.writeString(outstr);
-                continue;
+                size_t start = skipRecords(out1, 0, from);
+                size_t end = skipRecords(out1, start, to - from);
+                writer1.write(&out1[0] + start, end - start);
             }
         }
-        else
-            writer.writeString(outstr);
-
+        chunkFirstRead = chunkLastRead;
         delete chunk;
-        chunk = NULL;
     }
+
+    if(writer2)
+        delete writer2;
+    delete header;
 }
 
-void Repaq::decompressPE(){
-    RfqCodec codec;
-
-    ifstream input;
-    input.open(mOptions->in1, ios::in | ios::binary);
+/*
+* one thread reads the chunks ahead, mOptions->threadNum worker threads decode them into FASTQ text,
+* and the calling thread writes the text in the chunk order
+* if isPE is false, the reads of a paired-end RFQ are written to <out1> interleaved
+*/
+void Repaq::decompressPipeline(bool isPE) {
+    RfqReader rfq(mOptions->in1);
 
     Writer writer1(mOptions->out1);
-    Writer writer2(mOptions->out2);
+    Writer* writer2 = NULL;
+    if(isPE)
+        writer2 = new Writer(mOptions->out2);
 
-    RfqHeader* header = new RfqHeader();
-    header->read(input);
+    RfqHeader* header = rfq.header();
 
-    if( (header->mFlags & BIT_PAIRED_END) == false) {
+    if(isPE && (header->mFlags & BIT_PAIRED_END) == false) {
         error_exit("The input RFQ file was encoded by single-end FASTQ, you should not specify <out2>");
     }
 
-    codec.setHeader(header);
-
-    string outstr1;
-    string outstr2;
-    while(!input.eof()) {
-        RfqChunk* chunk = new RfqChunk(header);
-        chunk->read(input);
-        vector<Read*> reads = codec.decodeChunk(chunk);
-        if(reads.size() == 0) {
-            delete chunk;
-            break;
-        }
-
-        string outstr1;
-        string outstr2;
-
-        for(int r=0; r<reads.size(); r++) {
-            if(r%2==0)
-                outstr1 += reads[r]->toString();
-            else
-                outstr2 += reads[r]->toString();
-            delete reads[r];
-        }
-
-        bool isLastOne = false;
-        bool hasNoLineBreakAtEndR1 = chunk->mFlags & BIT_HAS_NO_LINE_BREAK_AT_END;
-        bool hasNoLineBreakAtEndR2 = chunk->mFlags & BIT_HAS_NO_LINE_BREAK_AT_END_R2;
-
-        if(hasNoLineBreakAtEndR1 || hasNoLineBreakAtEndR2) {
-            delete chunk;
-            chunk = NULL;
-            isLastOne = input.eof();
-            // eof sometime doesn't work, we need to check the last chunk to see if it's valid
-            if(!isLastOne) {
-                chunk = new RfqChunk(header);
-                chunk->read(input);
-                isLastOne = chunk->mReads == 0;
+    int threadNum = mOptions->threadNum;
+    TaskQueue<DecompressTask*> inputQueue(threadNum * 2);
+    ReorderBuffer<DecompressTask*> outputBuffer(threadNum * 4);
+
+    thread producer([&]{
+        long id = 0;
+        RfqChunk* chunk = rfq.next();
+        while(chunk) {
+            RfqChunk* next = rfq.next();
+            DecompressTask* task = new DecompressTask();
+            task->id = id;
+            task->chunk = chunk;
+            // the last chunk may need to drop the line break at the end
+            task->isLast = next == NULL;
+            inputQueue.push(task);
+            id++;
+            chunk = next;
+        }
+        inputQueue.close();
+        outputBuffer.finish(id);
+    });
+
+    vector<thread> workers;
+    for(int t=0; t<threadNum; t++) {
+        workers.push_back(thread([&]{
+            RfqCodec codec;
+            codec.setHeader(header);
+            DecompressTask* task = NULL;
+            while(inputQueue.pop(task)) {
+                RfqChunk* chunk = task->chunk;
+                codec.decodeChunk(chunk, task->out1, isPE ? &task->out2 : NULL);
+                if(task->isLast) {
+                    bool hasNoLineBreakAtEndR1 = chunk->mFlags & BIT_HAS_NO_LINE_BREAK_AT_END;
+                    bool hasNoLineBreakAtEndR2 = chunk->mFlags & BIT_HAS_NO_LINE_BREAK_AT_END_R2;
+                    if(hasNoLineBreakAtEndR1 && task->out1.length() > 0)
+                        task->out1.resize(task->out1.length() - 1);
+                    if(isPE && hasNoLineBreakAtEndR2 && task->out2.length() > 0)
+                        task->out2.resize(task->out2.length() - 1);
+                }
+                delete chunk;
+                task->chunk = NULL;
+                outputBuffer.put(task->id, task);
             }
-        }
+        }));
+    }
 
-        if(hasNoLineBreakAtEndR1) {
-            if(isLastOne) {
-                string nobreak = outstr1.substr(0, outstr1.length()-1);
-                writer1.writeString(nobreak);
-            } else {
-                writer1.writeString(outstr1);
-                continue;
-            }
-        }
-        else
-            writer1.writeString(outstr1);
+    DecompressTask* task = NULL;
+    while(outputBuffer.next(task)) {
+        writer1.writeString(task->out1);
+        if(writer2)
+            writer2->writeString(task->out2);
+        delete task;
+    }
 
-        if(hasNoLineBreakAtEndR2) {
-            if(isLastOne) {
-                string nobreak = outstr2.substr(0, outstr2.length()-1);
-                writer2.writeString(nobreak);
-            } else {
-                writer2.writeString(outstr2);
-                continue;
-            }
-        }
-        else
-            writer2.writeString(outstr2);
+    producer.join();
+    for(size_t t=0; t<workers.size(); t++)
+        workers[t].join();
 
-        delete chunk;
-    }
+    if(writer2)
+        delete writer2;
 }
 
 bool Repaq::hasLineBreakAtEnd(string& filename) {
@@ -427,336 +532,285 @@ bool Repaq::hasLineBreakAtEnd(string& filename) {
     return c=='\n';
 }
 
-bool Repaq::completeCheckAndOutput(RfqChunk* chunk, RfqCodec& codec4check, RfqHeader* header4check, vector<Read*>& reads, ostream& out) {
-    ostringstream oss;
-    istringstream iss;
-    chunk->write(oss);
-    out<<oss.str();
-    iss.str(oss.str());
+// decode the chunk from the bytes that have been written, and check it's identical with the input reads
+bool Repaq::verifyChunk(CompressTask* task, RfqCodec& codec4check, RfqHeader* header4check) {
+    istringstream iss(task->encoded);
     RfqChunk* chunk4check = new RfqChunk(header4check);
     chunk4check->read(iss);
     vector<Read*> reads4check = codec4check.decodeChunk(chunk4check);
-    //todo: check reads identity
-    if(reads4check.size() != reads.size()) {
-        error_exit("encoding error in chunk, the output will be wrong, quit now!");
-        return false;
-    }
+    ReadBatch* batch = task->batch;
+    // the read2 in the batch has been changed to reverse complement if the chunk is interleaved
+    bool peInterleaved = chunk4check->mFlags & BIT_PE_INTERLEAVED;
     bool identical = true;
-    for(int i=0; i<reads4check.size(); i++) {
-        Read* rfq = reads4check[i];
-        Read* fq = reads[i];
-        if(rfq->mName != fq->mName) {
-            cerr << "integrity check failure \nexpected: " << endl << fq->mName << endl << "got:\n" << rfq->mName << endl;
-            identical = false;
-            break;
-        }
-        else if(rfq->mSeq.mStr != fq->mSeq.mStr) {
-            cerr << "integrity check failure \nexpected: " << endl << fq->mSeq.mStr << endl << "got:\n" << rfq->mSeq.mStr << endl;
-            identical = false;
-            break;
-        }
-        else if(rfq->mStrand != fq->mStrand) {
-            cerr << "integrity check failure \nexpected: " << endl << fq->mStrand << endl << "got:\n" << rfq->mStrand << endl;
-            identical = false;
-            break;
-        }
-        else if(rfq->mQuality != fq->mQuality) {
-            cerr << "integrity check failure \nexpected: " << endl << fq->mQuality << endl << "got:\n" << rfq->mQuality << endl;
-            identical = false;
-            break;
-        }
-    }
-    delete chunk4check;
-    for(int r=0; r<reads4check.size(); r++)
-        delete reads4check[r];
-    reads4check.clear();
-    return identical;
-}
-
-bool Repaq::completeCheckAndOutput(RfqChunk* chunk, RfqCodec& codec4check, RfqHeader* header4check, vector<ReadPair*>& pairs, ostream& out) {
-    ostringstream oss;
-    istringstream iss;
-    chunk->write(oss);
-    out<<oss.str();
-    iss.str(oss.str());
-    RfqChunk* chunk4check = new RfqChunk(header4check);
-    chunk4check->read(iss);
-    vector<Read*> reads4check = codec4check.decodeChunk(chunk4check);
-    //todo: check reads identity
-    if(reads4check.size() != pairs.size()*2) {
-        error_exit("encoding error in chunk, the output will be wrong, quit now!");
-        return false;
+    if(reads4check.size() != (size_t)batch->size()) {
+        cerr << "integrity check failure \nexpected: " << endl << batch->size() << " reads" << endl << "got:\n" << reads4check.size() << " reads" << endl;
+        identical = false;
     }
-    bool identical = true;
-    for(int i=0; i<reads4check.size(); i++) {
+    for(size_t i=0; i<reads4check.size() && identical; i++) {
         Read* rfq = reads4check[i];
+        if(batch->mPaired && i%2==1 && peInterleaved)
+            rfq->changeToReverseComplement();
 
-        Read* fq;
-        if(i%2==0) {
-            fq = pairs[i/2]->mLeft;
-        } else {
-            fq = pairs[i/2]->mRight;
-            if(header4check->supportInterleaved())
-                rfq->changeToReverseComplement();
-        }
-        if(rfq->mName != fq->mName) {
-            cerr << "integrity check failure \nexpected: " << endl << fq->mName << endl << "got:\n" << rfq->mName << endl;
+        string seq(batch->seq(i), batch->length(i));
+        string qual(batch->qual(i), batch->length(i));
+        if(rfq->mName != batch->nameStr(i)) {
+            cerr << "integrity check failure \nexpected: " << endl << batch->nameStr(i) << endl << "got:\n" << rfq->mName << endl;
             identical = false;
-            break;
         }
-        if(rfq->mSeq.mStr != fq->mSeq.mStr) {
-            cerr << "integrity check failure \nexpected: " << endl << fq->mSeq.mStr << endl << "got:\n" << rfq->mSeq.mStr << endl;
+        else if(rfq->mSeq.mStr != seq) {
+            cerr << "integrity check failure \nexpected: " << endl << seq << endl << "got:\n" << rfq->mSeq.mStr << endl;
             identical = false;
-            break;
         }
-        if(rfq->mStrand != fq->mStrand) {
-            cerr << "integrity check failure \nexpected: " << endl << fq->mStrand << endl << "got:\n" << rfq->mStrand << endl;
+        else if(rfq->mStrand != batch->strandStr(i)) {
+            cerr << "integrity check failure \nexpected: " << endl << batch->strandStr(i) << endl << "got:\n" << rfq->mStrand << endl;
             identical = false;
-            break;
         }
-        if(rfq->mQuality != fq->mQuality) {
-            cerr << "integrity check failure \nexpected: " << endl << fq->mQuality << endl << "got:\n" << rfq->mQuality << endl;
+        else if(rfq->mQuality != qual) {
+            cerr << "integrity check failure \nexpected: " << endl << qual << endl << "got:\n" << rfq->mQuality << endl;
             identical = false;
-            break;
         }
     }
     delete chunk4check;
-    for(int r=0; r<reads4check.size(); r++)
+    for(size_t r=0; r<reads4check.size(); r++)
         delete reads4check[r];
     reads4check.clear();
     return identical;
 }
 
 void Repaq::compress(){
-    RfqCodec codec;
     FastqReader reader(mOptions->in1);
+    compressPipeline(&reader, NULL);
+}
 
-    ofstream out;
-    out.open(mOptions->out1, ios::out | ios::binary);
+void Repaq::compressPE(){
+    FastqReaderPair reader(mOptions->in1, mOptions->in2, true, false, mOptions->interleavedInput);
+    compressPipeline(NULL, &reader);
+}
 
-    // for double check
-    RfqCodec codec4check;
-    ostringstream ossHeader;
-    RfqHeader* header4check = new RfqHeader();
-    int pass = 0;
-
-    vector<Read*> reads;
-    RfqHeader* header = NULL;
-    uint32 totalBses = 0;
-    while(true){
-        Read* read = reader.read();
-        if(!read){
-            break;
-        }
-        reads.push_back(read);
-        totalBses += read->length();
-        if(totalBses >= mOptions->chunkSize) {
-            if(header == NULL) {
-                header = codec.makeHeader(reads);
-                header->write(ossHeader);
-                out<<ossHeader.str();
-                // for double check
-                istringstream issHeader;
-                issHeader.str(ossHeader.str());
-                header4check->read(issHeader);
-                codec4check.setHeader(header4check);
-                if(!header->identicalWith(header4check)) {
-                    error_exit("encoding error in header, the output will be wrong, quit now!");
-                }
-            }
-            if(header == NULL)
-                error_exit("failed to encode, please confirm the input FASTQ file is valid and not empty");
-            RfqChunk* chunk = codec.encodeChunk(reads);
-            if(chunk) {
-                if(reader.hasNoLineBreakAtEnd())
-                    chunk->mFlags |= BIT_HAS_NO_LINE_BREAK_AT_END;
-
-                // for double check
-                if(mOptions->completeCheck || (mOptions->fastCheck && pass%10 == 0)) {
-                    completeCheckAndOutput(chunk, codec4check, header4check, reads, out);
-                } else {
-                    chunk->write(out);
-                }
-                pass++;
+void Repaq::recycleCompressTask(CompressTask* task, TaskQueue<ReadBatch*>& batchPool) {
+    batchPool.push(task->batch);
+    delete task;
+}
 
-                delete chunk;
-            }
-            for(int r=0; r<reads.size(); r++)
-                delete reads[r];
-            reads.clear();
-            totalBses = 0;
-        }
+bool Repaq::needCheck(long pass) {
+    return mOptions->completeCheck || (mOptions->fastCheck && pass%10 == 0);
+}
+
+CompressTask* Repaq::readCompressTask(FastqReader* reader, FastqReaderPair* pairReader, TaskQueue<ReadBatch*>& batchPool) {
+    ReadBatch* batch = NULL;
+    batchPool.pop(batch);
+    batch->clear();
+    batch->mPaired = pairReader != NULL;
+
+    FastqReader* left = reader;
+    FastqReader* right = NULL;
+    if(pairReader) {
+        left = pairReader->mLeft;
+        right = mOptions->interleavedInput ? pairReader->mLeft : pairReader->mRight;
     }
-    if(reads.size() > 0) {
-        if(header == NULL) {
-            header = codec.makeHeader(reads);
-            header->write(ossHeader);
-            out<<ossHeader.str();
-            // for double check
-            istringstream issHeader;
-            issHeader.str(ossHeader.str());
-            header4check->read(issHeader);
-            codec4check.setHeader(header4check);
-            if(!header->identicalWith(header4check)) {
-                error_exit("encoding error in header, the output will be wrong, quit now!");
-            }
-        }
-        if(header == NULL)
-            error_exit("failed to encode, please confirm the input FASTQ file is valid and not empty");
-        RfqChunk* chunk = codec.encodeChunk(reads);
-        if(chunk) {
-            if(reader.hasNoLineBreakAtEnd())
-                chunk->mFlags |= BIT_HAS_NO_LINE_BREAK_AT_END;
-
-            // for double check
-            if(mOptions->completeCheck || (mOptions->fastCheck && pass%10 == 0)) {
-                completeCheckAndOutput(chunk, codec4check, header4check, reads, out);
-            } else {
-                chunk->write(out);
-            }
-            pass++;
 
-            delete chunk;
+    FastqRecord rec;
+    while(batch->totalBases() < (uint32)mOptions->chunkSize) {
+        // the record is copied into the batch before the reader moves on
+        if(!left->readRecord(rec))
+            break;
+        batch->append(rec);
+        if(right) {
+            if(!right->readRecord(rec)) {
+                batch->removeLast();
+                break;
+            }
+            batch->append(rec);
         }
-        for(int r=0; r<reads.size(); r++)
-            delete reads[r];
-        reads.clear();
     }
-    out.flush();
-    out.close();
 
-    if(header) {
-        delete header;
-        header = NULL;
+    if(batch->size() == 0) {
+        batchPool.push(batch);
+        return NULL;
     }
 
-    // for double check
-    if(header4check) {
-        delete header4check;
-        header4check = NULL;
+    CompressTask* task = new CompressTask();
+    task->id = 0;
+    task->batch = batch;
+    task->lineBreakFlags = 0;
+
+    // check the line breaks right after this chunk is read, the same as the single-threaded encoder did
+    if(pairReader) {
+        bool noLineBreakAtEnd = pairReader->mLeft->hasNoLineBreakAtEnd();
+        bool noLineBreakAtEndR2;
+        if(!mOptions->interleavedInput)
+            noLineBreakAtEndR2 = pairReader->mRight->hasNoLineBreakAtEnd();
+        else
+            noLineBreakAtEndR2 = noLineBreakAtEnd;
+        if(noLineBreakAtEnd)
+            task->lineBreakFlags |= BIT_HAS_NO_LINE_BREAK_AT_END;
+        if(noLineBreakAtEndR2)
+            task->lineBreakFlags |= BIT_HAS_NO_LINE_BREAK_AT_END_R2;
+    } else {
+        if(reader->hasNoLineBreakAtEnd())
+            task->lineBreakFlags |= BIT_HAS_NO_LINE_BREAK_AT_END;
     }
-}
 
-void Repaq::compressPE(){
-    RfqCodec codec;
-    FastqReaderPair reader(mOptions->in1, mOptions->in2, true, false, mOptions->interleavedInput);
+    return task;
+}
 
+/*
+* one thread reads the FASTQ into chunks of reads,
+* mOptions->threadNum worker threads encode the chunks,
+* and the calling thread writes the encoded chunks in the input order
+*/
+void Repaq::compressPipeline(FastqReader* reader, FastqReaderPair* pairReader) {
     ofstream out;
     out.open(mOptions->out1, ios::out | ios::binary);
 
+    int threadNum = mOptions->threadNum;
+
+    // the batches are recycled, so their arenas are only allocated for the first few chunks
+    int batchNum = threadNum * 8 + 2;
+    TaskQueue<ReadBatch*> batchPool(batchNum);
+    for(int b=0; b<batchNum; b++)
+        batchPool.push(new ReadBatch());
+
+    // the header is made from the first chunk, so read it before starting the workers
+    CompressTask* first = readCompressTask(reader, pairReader, batchPool);
+    if(first == NULL) {
+        out.close();
+        return;
+    }
+
+    RfqCodec codec;
+    RfqHeader* header = codec.makeHeader(*first->batch);
+    if(header == NULL)
+        error_exit("failed to encode, please confirm the input FASTQ file is valid and not empty");
+    if(mOptions->qualCodec == "rans")
+        header->mFlags |= BIT_QUAL_RANS;
+    else if(mOptions->qualCodec == "cm")
+        header->mFlags |= BIT_QUAL_CM;
+    if(mOptions->seqCodec == "cm")
+        header->mFlags |= BIT_SEQ_CM;
+
     // for double check
-    RfqCodec codec4check;
     ostringstream ossHeader;
     RfqHeader* header4check = new RfqHeader();
-    int pass = 0;
-
-    vector<ReadPair*> reads;
-    RfqHeader* header = NULL;
-    uint32 totalBses = 0;
-    while(true){
-        ReadPair* read = reader.read();
-        if(!read){
-            break;
-        }
-        reads.push_back(read);
-        totalBses += read->mLeft->length() + read->mRight->length();
-        if(totalBses >= mOptions->chunkSize) {
-            if(header == NULL) {
-                header = codec.makeHeader(reads);
-                header->write(ossHeader);
-                out<<ossHeader.str();
-                // for double check
-                istringstream issHeader;
-                issHeader.str(ossHeader.str());
-                header4check->read(issHeader);
-                // copy the mSupportInterleaved flag which is not stored in file
-                header4check->mSupportInterleaved = header->mSupportInterleaved;
-                codec4check.setHeader(header4check);
-                if(!header->identicalWith(header4check)) {
-                    error_exit("encoding error in header, the output will be wrong, quit now!");
+
+    header->write(ossHeader);
+    out<<ossHeader.str();
+    istringstream issHeader;
+    issHeader.str(ossHeader.str());
+    header4check->read(issHeader);
+    // copy the mSupportInterleaved flag which is not stored in file
+    header4check->mSupportInterleaved = header->mSupportInterleaved;
+    if(!header->identicalWith(header4check)) {
+        error_exit("encoding error in header, the output will be wrong, quit now!");
+    }
+
+    TaskQueue<CompressTask*> inputQueue(threadNum * 2);
+    ReorderBuffer<CompressTask*> outputBuffer(threadNum * 4);
+    atomic_bool verifyFailed(false);
+
+    thread producer([&]{
+        long id = 0;
+        CompressTask* task = first;
+        while(task) {
+            task->id = id;
+            id++;
+            inputQueue.push(task);
+            // stop reading once a chunk fails the check, and the queued tasks are drained
+            if(verifyFailed)
+                break;
+            task = readCompressTask(reader, pairReader, batchPool);
+        }
+        inputQueue.close();
+        outputBuffer.finish(id);
+    });
+
+    vector<thread> workers;
+    for(int t=0; t<threadNum; t++) {
+        workers.push_back(thread([&]{
+            RfqCodec workerCodec;
+            workerCodec.setHeader(header);
+            if(mOptions->qualCodec == "auto")
+                workerCodec.setAdaptiveQual(mOptions->qualTrialReads);
+            CompressTask* task = NULL;
+            while(inputQueue.pop(task)) {
+                RfqChunk* chunk = workerCodec.encodeChunk(*task->batch);
+                if(chunk) {
+                    chunk->mFlags |= task->lineBreakFlags;
+                    ostringstream oss;
+                    chunk->write(oss);
+                    task->encoded = oss.str();
+                    delete chunk;
                 }
+                outputBuffer.put(task->id, task);
             }
-            if(header == NULL)
-                error_exit("failed to encode, please confirm the input FASTQ file is valid and not empty");
-            RfqChunk* chunk = codec.encodeChunk(reads);
-            if(chunk) {
-                bool noLineBreakAtEnd = reader.mLeft->hasNoLineBreakAtEnd();
-                bool noLineBreakAtEndR2;
-                if(!mOptions->interleavedInput)
-                    noLineBreakAtEndR2 = reader.mRight->hasNoLineBreakAtEnd();
-                else
-                    noLineBreakAtEndR2 = noLineBreakAtEnd;
-                if(noLineBreakAtEnd)
-                    chunk->mFlags |= BIT_HAS_NO_LINE_BREAK_AT_END;
-                if(noLineBreakAtEndR2)
-                    chunk->mFlags |= BIT_HAS_NO_LINE_BREAK_AT_END_R2;
-                
-                // for double check
-                if(mOptions->completeCheck || (mOptions->fastCheck && pass%10 == 0)) {
-                    completeCheckAndOutput(chunk, codec4check, header4check, reads, out);
-                } else {
-                    chunk->write(out);
-                }
-                pass++;
+        }));
+    }
 
-                delete chunk;
-            }
-            for(int r=0; r<reads.size(); r++)
-                delete reads[r];
-            reads.clear();
-            totalBses = 0;
+    // the written chunks are verified by another pool, so the encoding doesn't wait for it
+    TaskQueue<CompressTask*> verifyQueue(threadNum * 2);
+    vector<thread> verifiers;
+    if(mOptions->completeCheck || mOptions->fastCheck) {
+        for(int t=0; t<threadNum; t++) {
+            verifiers.push_back(thread([&]{
+                RfqCodec codec4check;
+                codec4check.setHeader(header4check);
+                CompressTask* task = NULL;
+                while(verifyQueue.pop(task)) {
+                    if(!verifyFailed && !verifyChunk(task, codec4check, header4check))
+                        verifyFailed = true;
+                    recycleCompressTask(task, batchPool);
+                }
+            }));
         }
     }
-    if(reads.size() > 0) {
-        if(header == NULL) {
-            header = codec.makeHeader(reads);
-            header->write(ossHeader);
-            out<<ossHeader.str();
-            // for double check
-            istringstream issHeader;
-            issHeader.str(ossHeader.str());
-            header4check->read(issHeader);
-            // copy the mSupportInterleaved flag which is not stored in file
-            header4check->mSupportInterleaved = header->mSupportInterleaved;
-            codec4check.setHeader(header4check);
-            if(!header->identicalWith(header4check)) {
-                error_exit("encoding error in header, the output will be wrong, quit now!");
-            }
-        }
-        if(header == NULL)
-            error_exit("failed to encode, please confirm the input FASTQ file is valid and not empty");
-        RfqChunk* chunk = codec.encodeChunk(reads);
-        if(chunk) {
-            bool noLineBreakAtEnd = reader.mLeft->hasNoLineBreakAtEnd();
-            bool noLineBreakAtEndR2;
-            if(!mOptions->interleavedInput)
-                noLineBreakAtEndR2 = reader.mRight->hasNoLineBreakAtEnd();
-            else
-                noLineBreakAtEndR2 = noLineBreakAtEnd;
-            if(noLineBreakAtEnd)
-                chunk->mFlags |= BIT_HAS_NO_LINE_BREAK_AT_END;
-            if(noLineBreakAtEndR2)
-                chunk->mFlags |= BIT_HAS_NO_LINE_BREAK_AT_END_R2;
-
-            // for double check
-            if(mOptions->completeCheck || (mOptions->fastCheck && pass%10 == 0)) {
-                completeCheckAndOutput(chunk, codec4check, header4check, reads, out);
-            } else {
-                chunk->write(out);
-            }
-            pass++;
-        
-            delete chunk;
-        }
-        for(int r=0; r<reads.size(); r++)
-            delete reads[r];
-        reads.clear();
+
+    // the chunk offsets are counted by the bytes written, so they are also right for STDOUT
+    RfqIndex index;
+    uint64 written = ossHeader.str().length();
+    CompressTask* task = NULL;
+    while(outputBuffer.next(task)) {
+        // after a chunk fails the check, the rest are recycled without being written,
+        // so the producer and the workers are never blocked on the queues and can be joined
+        if(verifyFailed) {
+            recycleCompressTask(task, batchPool);
+            continue;
+        }
+        out.write(task->encoded.c_str(), task->encoded.length());
+        index.addChunk(written, task->batch->size(), task->batch->totalBases());
+        written += task->encoded.length();
+        if(needCheck(task->id))
+            verifyQueue.push(task);
+        else
+            recycleCompressTask(task, batchPool);
     }
+
+    verifyQueue.close();
+    for(size_t t=0; t<verifiers.size(); t++)
+        verifiers[t].join();
+
+    producer.join();
+    for(size_t t=0; t<workers.size(); t++)
+        workers[t].join();
+
+    if(verifyFailed) {
+        out.close();
+        if(mOptions->out1 != "/dev/stdout")
+            remove(mOptions->out1.c_str());
+        error_exit("encoding error in chunk, the output will be wrong, quit now!");
+    }
+
+    if(mOptions->writeIndex)
+        index.write(out, written);
+
     out.flush();
     out.close();
 
-    if(header) {
-        delete header;
-        header = NULL;
+    ReadBatch* batch = NULL;
+    for(int b=0; b<batchNum; b++) {
+        batchPool.pop(batch);
+        delete batch;
     }
-}
\ No newline at end of file
+
+    delete header;
+    delete header4check;
+}
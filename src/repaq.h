@@ -6,9 +6,65 @@
 #include <string>
 #include "rfqcodec.h"
 #include "options.h"
+#include "fastqreader.h"
+#include "readbatch.h"
+#include "pipeline.h"
 
 using namespace std;
 
+// a chunk of reads travelling through the compression pipeline
+struct CompressTask{
+    long id;
+    // recycled to the pool of batches when this task is done
+    ReadBatch* batch;
+    // BIT_HAS_NO_LINE_BREAK_AT_END flags, captured when this chunk was read
+    uint16 lineBreakFlags;
+    // the serialized chunk
+    string encoded;
+};
+
+// a chunk travelling through the decompression pipeline
+struct DecompressTask{
+    long id;
+    RfqChunk* chunk;
+    // whether this is the last chunk in the file
+    bool isLast;
+    // the decoded FASTQ text, out2 is only used for paired-end output
+    string out1;
+    string out2;
+};
+
+#define COMPARE_PASSED 0
+#define COMPARE_MORE_RFQ_READS 1
+#define COMPARE_DIFFERENT_NAME 2
+#define COMPARE_DIFFERENT_SEQ 3
+#define COMPARE_DIFFERENT_STRAND 4
+#define COMPARE_DIFFERENT_QUAL 5
+
+// a decoded chunk and its matching FASTQ reads in the compare pipeline
+struct CompareTask{
+    CompareTask() {
+        id = 0;
+        chunk = NULL;
+        result = COMPARE_PASSED;
+        rfqReads = 0;
+        rfqBases = 0;
+        fqReads = 0;
+        fqBases = 0;
+    }
+    long id;
+    RfqChunk* chunk;
+    vector<Read*> decoded;
+    vector<Read*> original;
+    // the comparison result, the counters stop at the first difference
+    int result;
+    string detail;
+    long rfqReads;
+    long rfqBases;
+    long fqReads;
+    long fqBases;
+};
+
 class Repaq{
 public:
     Repaq(Options* opt);
@@ -23,8 +79,16 @@ public:
 private:
     bool hasLineBreakAtEnd(string& filename);
     void reportCompareResult(bool passed, string message, long fqReads, long fqBases, long rfqReads, long rfqBases);
-    bool completeCheckAndOutput(RfqChunk* chunk, RfqCodec& codec4check, RfqHeader* header4check, vector<Read*>& reads, ostream& out);
-    bool completeCheckAndOutput(RfqChunk* chunk, RfqCodec& codec4check, RfqHeader* header4check, vector<ReadPair*>& pairs, ostream& out);
+    bool verifyChunk(CompressTask* task, RfqCodec& codec4check, RfqHeader* header4check);
+    void recycleCompressTask(CompressTask* task, TaskQueue<ReadBatch*>& batchPool);
+    void compressPipeline(FastqReader* reader, FastqReaderPair* pairReader);
+    CompressTask* readCompressTask(FastqReader* reader, FastqReaderPair* pairReader, TaskQueue<ReadBatch*>& batchPool);
+    bool needCheck(long pass);
+    void decompressPipeline(bool isPE);
+    void decompressRange(bool isPE);
+    void comparePipeline(FastqReader* reader, FastqReaderPair* pairReader);
+    void compareReads(CompareTask* task);
+    string compareFailureMessage(CompareTask* task, bool isPE, long fqReads, long rfqReads);
 
 private:
     Options* mOptions;
@@ -1,23 +1,28 @@
 #include "rfqchunk.h"
 #include <memory.h>
 #include "endian.h"
+#include "util.h"
 
 RfqChunk::RfqChunk(RfqHeader* header){
     memset(this, 0, sizeof(RfqChunk));
     mHeader = header;
+    mOwnsBuffers = true;
 }
 
 RfqChunk::~RfqChunk(){
+    // the read length and tile buffers are always owned, since they are copied to be aligned
     if(mReadLenBuf)
         delete[] mReadLenBuf;
+    if(mTileBuf)
+        delete[] mTileBuf;
+    if(!mOwnsBuffers)
+        return;
     if(mName1LenBuf)
         delete[] mName1LenBuf;
     if(mName2LenBuf)
         delete[] mName2LenBuf;
     if(mLaneBuf)
         delete[] mLaneBuf;
-    if(mTileBuf)
-        delete[] mTileBuf;
     if(mXBuf)
         delete[] mXBuf;
     if(mYBuf)
@@ -138,29 +143,57 @@ void RfqChunk::readTileBuf(istream& ifs) {
     }
 }
 
+bool RfqChunk::name1Tokenized() {
+    return mHeader->nameTokens() && (mFlags & BIT_NAME1_SAME) == false;
+}
+
+bool RfqChunk::name2Dictionary() {
+    return mHeader->hasName2() && mHeader->name2Dict() && (mFlags & BIT_NAME2_SAME) == false;
+}
+
+// the exact number of bytes written by write()
 void RfqChunk::calcTotalBufSize() {
     mSize = sizeof(mSize) + sizeof(mReads) + sizeof(mFlags) + sizeof(mSeqBufSize) + sizeof(mQualBufSize);
-    mSize +=  mReadLenBufSize + mName1LenBufSize + mName2LenBufSize + mStrandLenBufSize;
-    mSize += mLaneBufSize + mTileBufSize + mName1BufSize + mName2BufSize + mStrandBufSize;
-    mSize += mSeqBufSize + mQualBufSize;
+    if(mHeader->encodeNPos())
+        mSize += sizeof(mNPosBufSize);
+    mSize += mReadLenBufSize + mName1LenBufSize + mStrandLenBufSize;
+    if(mHeader->hasName2())
+        mSize += mName2LenBufSize;
+
+    int perReadCount = mReads;
+    if(mFlags & BIT_PE_INTERLEAVED)
+        perReadCount = mReads/2;
+    if(mHeader->hasLane())
+        mSize += sizeof(uint8) * ((mFlags & BIT_LANE_SAME) ? 1 : perReadCount);
+    if(mHeader->hasTile())
+        mSize += sizeof(uint16) * ((mFlags & BIT_TILE_SAME) ? 1 : perReadCount);
+    if(mHeader->hasX())
+        mSize += sizeof(mXBufSize) + mXBufSize;
+    if(mHeader->hasY())
+        mSize += sizeof(mYBufSize) + mYBufSize;
+
+    if(name1Tokenized())
+        mSize += sizeof(mName1BufSize);
+    if(name2Dictionary())
+        mSize += sizeof(mName2BufSize);
+    mSize += mName1BufSize + mStrandBufSize + mSeqBufSize + mQualBufSize;
+    if(mHeader->hasName2())
+        mSize += mName2BufSize;
     // overlap buf size;
     if( (mFlags & BIT_PE_INTERLEAVED) && (mHeader->mFlags & BIT_ENCODE_PE_BY_OVERLAP))
         mSize += mReads/2;
-    if(mHeader->encodeNPos()) {
-        mSize += sizeof(mNPosBufSize);
+    if(mHeader->encodeNPos())
         mSize += mNPosBufSize;
-    }
-    if(mHeader->hasX()) {
-        mSize += sizeof(mXBufSize) + mXBufSize;
-    }
-    if(mHeader->hasY()) {
-        mSize += sizeof(mYBufSize) + mYBufSize;
-    }
 }
 
 void RfqChunk::read(istream& ifs) {
     //ifs.read((char*)&mSize, sizeof(uint32));
     mSize = readLittleEndian32(ifs);
+    // a zero size marks the end of chunks, which can be followed by the index
+    if(mSize == 0) {
+        mReads = 0;
+        return;
+    }
     //ifs.read((char*)&mReads, sizeof(uint32));
     mReads = readLittleEndian32(ifs);
     //ifs.read((char*)&mFlags, sizeof(uint16));
@@ -199,10 +232,14 @@ void RfqChunk::read(istream& ifs) {
         ifs.read((char*)mYBuf, mYBufSize);
     }
 
+    if(name1Tokenized())
+        mName1BufSize = readLittleEndian32(ifs);
     mName1Buf = new char[mName1BufSize];
     ifs.read(mName1Buf, mName1BufSize);
 
     if(mHeader->hasName2()) {
+        if(name2Dictionary())
+            mName2BufSize = readLittleEndian32(ifs);
         mName2Buf = new char[mName2BufSize];
         ifs.read(mName2Buf, mName2BufSize);
     }
@@ -227,6 +264,123 @@ void RfqChunk::read(istream& ifs) {
     }
 }
 
+// take the next len bytes of the chunk data, the chunk is truncated if there are not enough bytes
+const char* RfqChunk::take(const char* data, uint64 dataLen, uint64& pos, uint64 len) {
+    if(pos + len > dataLen)
+        error_exit("the RFQ chunk is truncated, the file may be incomplete");
+    const char* ret = data + pos;
+    pos += len;
+    return ret;
+}
+
+uint32 RfqChunk::take32(const char* data, uint64 dataLen, uint64& pos) {
+    uint32 val;
+    memcpy(&val, take(data, dataLen, pos, sizeof(uint32)), sizeof(uint32));
+    return adaptToLittleEndian(val);
+}
+
+uint64 RfqChunk::parse(const char* data, uint64 dataLen) {
+    mOwnsBuffers = false;
+    uint64 pos = 0;
+
+    mSize = take32(data, dataLen, pos);
+    // a zero size marks the end of chunks, which can be followed by the index
+    if(mSize == 0) {
+        mReads = 0;
+        return pos;
+    }
+    mReads = take32(data, dataLen, pos);
+    uint16 flags;
+    memcpy(&flags, take(data, dataLen, pos, sizeof(uint16)), sizeof(uint16));
+    mFlags = adaptToLittleEndian(flags);
+    mSeqBufSize = take32(data, dataLen, pos);
+    mQualBufSize = take32(data, dataLen, pos);
+    if(mHeader->encodeNPos())
+        mNPosBufSize = take32(data, dataLen, pos);
+
+    // read length, copied since it's accessed as uint16 or uint32
+    int readLenCount = 1;
+    if((mFlags & BIT_READ_LEN_SAME) == false)
+        readLenCount = mReads;
+    int bytes = mHeader->mReadLengthBytes;
+    mReadLenBufSize = readLenCount * bytes;
+    mReadLenBuf = new uint8[mReadLenBufSize];
+    memcpy(mReadLenBuf, take(data, dataLen, pos, mReadLenBufSize), mReadLenBufSize);
+
+    mName1LenBufSize = (mFlags & BIT_NAME1_LEN_SAME) ? 1 : mReads;
+    mName1LenBuf = (uint8*)take(data, dataLen, pos, mName1LenBufSize);
+    mName1BufSize = 0;
+    for(uint32 i=0; i<mName1LenBufSize; i++)
+        mName1BufSize += mName1LenBuf[i];
+    if( (mFlags & BIT_NAME1_LEN_SAME) &&  (mFlags & BIT_NAME1_SAME)==false)
+        mName1BufSize *= mReads;
+
+    if(mHeader->hasName2()) {
+        mName2LenBufSize = (mFlags & BIT_NAME2_LEN_SAME) ? 1 : mReads;
+        mName2LenBuf = (uint8*)take(data, dataLen, pos, mName2LenBufSize);
+        mName2BufSize = 0;
+        for(uint32 i=0; i<mName2LenBufSize; i++)
+            mName2BufSize += mName2LenBuf[i];
+        if( (mFlags & BIT_NAME2_LEN_SAME) &&  (mFlags & BIT_NAME2_SAME)==false)
+            mName2BufSize *= mReads;
+    }
+
+    mStrandLenBufSize = (mFlags & BIT_STRAND_LEN_SAME) ? 1 : mReads;
+    mStrandLenBuf = (uint8*)take(data, dataLen, pos, mStrandLenBufSize);
+    mStrandBufSize = 0;
+    for(uint32 i=0; i<mStrandLenBufSize; i++)
+        mStrandBufSize += mStrandLenBuf[i];
+    if( (mFlags & BIT_STRAND_LEN_SAME) &&  (mFlags & BIT_STRAND_SAME)==false)
+        mStrandBufSize *= mReads;
+
+    int perReadCount = mReads;
+    if(mFlags & BIT_PE_INTERLEAVED)
+        perReadCount = mReads / 2;
+    if(mHeader->hasLane()) {
+        int laneCount = (mFlags & BIT_LANE_SAME) ? 1 : perReadCount;
+        mLaneBuf = (uint8*)take(data, dataLen, pos, laneCount);
+    }
+    if(mHeader->hasTile()) {
+        // copied to be aligned and in the host byte order
+        int tileCount = (mFlags & BIT_TILE_SAME) ? 1 : perReadCount;
+        mTileBuf = new uint16[tileCount];
+        memcpy(mTileBuf, take(data, dataLen, pos, sizeof(uint16)*tileCount), sizeof(uint16)*tileCount);
+        if(!isLittleEndian()) {
+            for(int i=0; i<tileCount; i++)
+                mTileBuf[i] = adaptToLittleEndian(mTileBuf[i]);
+        }
+    }
+
+    if(mHeader->hasX()) {
+        mXBufSize = take32(data, dataLen, pos);
+        mXBuf = (uint8*)take(data, dataLen, pos, mXBufSize);
+    }
+    if(mHeader->hasY()) {
+        mYBufSize = take32(data, dataLen, pos);
+        mYBuf = (uint8*)take(data, dataLen, pos, mYBufSize);
+    }
+
+    if(name1Tokenized())
+        mName1BufSize = take32(data, dataLen, pos);
+    mName1Buf = (char*)take(data, dataLen, pos, mName1BufSize);
+    if(mHeader->hasName2()) {
+        if(name2Dictionary())
+            mName2BufSize = take32(data, dataLen, pos);
+        mName2Buf = (char*)take(data, dataLen, pos, mName2BufSize);
+    }
+    mStrandBuf = (char*)take(data, dataLen, pos, mStrandBufSize);
+    mSeqBuf = (char*)take(data, dataLen, pos, mSeqBufSize);
+    mQualBuf = (uint8*)take(data, dataLen, pos, mQualBufSize);
+
+    if( (mFlags & BIT_PE_INTERLEAVED) && (mHeader->mFlags & BIT_ENCODE_PE_BY_OVERLAP))
+        mOverlapBuf = (char*)take(data, dataLen, pos, mReads/2);
+
+    if(mHeader->encodeNPos())
+        mNPosBuf = (uint8*)take(data, dataLen, pos, mNPosBufSize);
+
+    return pos;
+}
+
 void RfqChunk::write(ostream& ofs) {
     //ofs.write((const char*)&mSize, sizeof(uint32));
     writeLittleEndian(ofs, mSize);
@@ -295,9 +449,14 @@ void RfqChunk::write(ostream& ofs) {
         ofs.write((const char*)mYBuf, mYBufSize);
     }
 
+    if(name1Tokenized())
+        writeLittleEndian(ofs, mName1BufSize);
     ofs.write(mName1Buf, mName1BufSize);
-    if(mHeader->hasName2())
+    if(mHeader->hasName2()) {
+        if(name2Dictionary())
+            writeLittleEndian(ofs, mName2BufSize);
         ofs.write(mName2Buf, mName2BufSize);
+    }
     ofs.write(mStrandBuf, mStrandBufSize);
     ofs.write(mSeqBuf, mSeqBufSize);
     ofs.write((char*)mQualBuf, mQualBufSize);
@@ -48,12 +48,31 @@ using namespace std;
 #define BIT_HAS_NO_LINE_BREAK_AT_END (1<<10)
 // if set, the encoded stream R2 has line break in the file end
 #define BIT_HAS_NO_LINE_BREAK_AT_END_R2 (1<<11)
+// if set, the quality buffer starts with the chunk's own quality table, which replaces the header's (column mode only)
+// it's <bins> followed by <bins> qualities, and the first one is the major quality
+#define BIT_HAS_QUAL_TABLE (1<<12)
+// the quality codec of the chunk is kept in the bits 13~15, and 0 means the one given by the header flags
+// the encoder can choose the codec chunk by chunk (see --qual_codec auto)
+#define QUAL_CODEC_SHIFT 13
+#define QUAL_CODEC_MASK (0x07 << QUAL_CODEC_SHIFT)
+#define QUAL_CODEC_HEADER 0
+#define QUAL_CODEC_RAW 1
+#define QUAL_CODEC_RLE 2
+#define QUAL_CODEC_COL 3
+#define QUAL_CODEC_RANS 4
+#define QUAL_CODEC_CM 5
+// 2 bits per quality in 2 bit planes, for the chunks with 4 or fewer qualities, if not bigger than the column coding
+// it's <4 different qualities, the most frequent first><low plane><high plane>
+#define QUAL_CODEC_PLANES 6
 
 class RfqChunk{
 public:
     RfqChunk(RfqHeader* header);
     ~RfqChunk();
     void read(istream& ifs);
+    // parse the chunk in place, the buffers point into data, which must outlive this chunk
+    // return the bytes parsed
+    uint64 parse(const char* data, uint64 dataLen);
     void write(ostream& ofs);
     void calcTotalBufSize();
 
@@ -64,9 +83,16 @@ private:
     void readStrandLenBuf(istream& ifs);
     void readLaneBuf(istream& ifs);
     void readTileBuf(istream& ifs);
+    const char* take(const char* data, uint64 dataLen, uint64& pos, uint64 len);
+    uint32 take32(const char* data, uint64 dataLen, uint64& pos);
+    // the token coded name1 doesn't have the size given by the name1 lengths, so the size is stored before it
+    bool name1Tokenized();
+    // so is the dictionary coded name2
+    bool name2Dictionary();
 
 public:
-    // the entire buffer size of this chunk
+    // the entire buffer size of this chunk, including this field
+    // it's exact since ALGORITHM_VER 3, and 0 marks the end of chunks
     uint32 mSize;
     // how many reads in this chunk
     uint32 mReads;
@@ -111,6 +137,8 @@ public:
     uint32 mStrandBufSize;
 
     RfqHeader* mHeader;
+    // false if the buffers point into a parsed memory, except mReadLenBuf and mTileBuf
+    bool mOwnsBuffers;
 };
 
 #endif
\ No newline at end of file
@@ -5,34 +5,82 @@
 #include <memory.h>
 #include <sstream>
 #include "endian.h"
+#include "simd.h"
+#include "rans.h"
+#include "qualcm.h"
+#include "seqcm.h"
 
 RfqCodec::RfqCodec(){
     mHeader = NULL;
+    mChunkQualTable = false;
+    mChunkQualCodec = QUAL_CODEC_HEADER;
+    mAdaptiveQual = false;
+    mQualTrialReads = 0;
 }
 
 RfqCodec::~RfqCodec(){
 }
 
+// write val as a varint, 7 bits per byte from the lowest bits, and return the bytes written
+static inline uint32 writeVarint(uint8* buf, uint32 val) {
+    uint32 n = 0;
+    while(val >= 0x80) {
+        buf[n++] = (val & 0x7F) | 0x80;
+        val >>= 7;
+    }
+    buf[n++] = val;
+    return n;
+}
+
+// read a varint written by writeVarint, and return the position after it
+static inline const uint8* readVarint(const uint8* p, const uint8* end, uint32& val) {
+    val = 0;
+    int shift = 0;
+    while(p < end && shift < 32) {
+        uint8 byte = *p++;
+        val |= (uint32)(byte & 0x7F) << shift;
+        if((byte & 0x80) == 0)
+            break;
+        shift += 7;
+    }
+    return p;
+}
+
+// whether NAME2 of read2 is NAME2 of read1 with the different char replaced
+static bool name2Matches(const char* name2R1, int len1, const char* name2R2, int len2, int diffPos, char diffChar) {
+    if(len1 != len2)
+        return false;
+    for(int p=0; p<len1; p++) {
+        char c = name2R1[p];
+        // !='\0' means it has only one difference
+        if(p == diffPos && diffChar != '\0')
+            c = diffChar;
+        if(c != name2R2[p])
+            return false;
+    }
+    return true;
+}
+
 void RfqCodec::setHeader(RfqHeader* header) {
     mHeader = header;
 }
 
-RfqHeader* RfqCodec::makeHeader(vector<Read*>& reads) {
-    if(reads.size() == 0)
+RfqHeader* RfqCodec::makeHeader(ReadBatch& batch) {
+    if(batch.mPaired)
+        return makeHeaderPE(batch);
+
+    if(batch.size() == 0)
         return NULL;
 
     RfqHeader* header = new RfqHeader();
     bool hasLaneTileXY = true;
     int maxReadLen = 0;
 
-    string qualStr;
-
-    for(int i=0; i<reads.size(); i++) {
-        Read* r = reads[i];
-        FastqMeta meta = FastqMeta::parse(r->mName);
+    FastqNameFields meta;
+    for(int i=0; i<batch.size(); i++) {
+        FastqMeta::parse(batch.name(i), batch.nameLen(i), meta);
         hasLaneTileXY &= meta.hasLaneTileXY;
-        maxReadLen = max(maxReadLen, r->length());
-        qualStr += r->mQuality;
+        maxReadLen = max(maxReadLen, batch.length(i));
     }
 
     if(hasLaneTileXY) {
@@ -43,7 +91,10 @@ RfqHeader* RfqCodec::makeHeader(vector<Read*>& reads) {
         header->mFlags |= BIT_HAS_NAME2;
     }
 
-    header->makeQualityTable(reads, hasLaneTileXY);
+    header->mFlags |= BIT_NAME_TOKENS;
+    header->mFlags |= BIT_NAME2_DICT;
+
+    header->makeQualityTable(batch, hasLaneTileXY);
 
     if(maxReadLen>65535)
         header->mReadLengthBytes = 4;
@@ -56,12 +107,11 @@ RfqHeader* RfqCodec::makeHeader(vector<Read*>& reads) {
     return header;
 }
 
-RfqHeader* RfqCodec::makeHeader(vector<ReadPair*>& pairs) {
-    if(pairs.size() == 0)
+RfqHeader* RfqCodec::makeHeaderPE(ReadBatch& batch) {
+    int pairs = batch.size() / 2;
+    if(pairs == 0)
         return NULL;
 
-    vector<Read*> allReads;
-
     RfqHeader* header = new RfqHeader();
     bool hasLaneTileXY = true;
     int maxReadLen = 0;
@@ -70,45 +120,39 @@ RfqHeader* RfqCodec::makeHeader(vector<ReadPair*>& pairs) {
     int name2DiffPos = 0;
     char name2DiffChar = '\0';
 
-    string qualStr;
-
-    for(int i=0; i<pairs.size(); i++) {
-        Read* r1 = pairs[i]->mLeft;
-        Read* r2 = pairs[i]->mRight;
-        allReads.push_back(r1);
-        allReads.push_back(r2);
-        qualStr += r1->mQuality;
-        qualStr += r2->mQuality;
-        FastqMeta meta1 = FastqMeta::parse(r1->mName);
-        FastqMeta meta2 = FastqMeta::parse(r2->mName);
+    FastqNameFields meta1;
+    FastqNameFields meta2;
+    for(int i=0; i<pairs; i++) {
+        FastqMeta::parse(batch.name(i*2), batch.nameLen(i*2), meta1);
+        FastqMeta::parse(batch.name(i*2+1), batch.nameLen(i*2+1), meta2);
+        const char* name2R1 = batch.name(i*2) + meta1.name2Start;
+        const char* name2R2 = batch.name(i*2+1) + meta2.name2Start;
         hasLaneTileXY &= meta1.hasLaneTileXY;
         hasLaneTileXY &= meta2.hasLaneTileXY;
-        maxReadLen = max(maxReadLen, r1->length());
-        maxReadLen = max(maxReadLen, r2->length());
+        maxReadLen = max(maxReadLen, batch.length(i*2));
+        maxReadLen = max(maxReadLen, batch.length(i*2+1));
 
         if(!hasLaneTileXY)
             supportInterleaved = false;
         else if(supportInterleaved){
             if(i == 0) {
-                if(meta1.namePart2.length() != meta2.namePart2.length())
+                if(meta1.name2Len != meta2.name2Len)
                     supportInterleaved = false;
 
-                for(int p=0; p<meta1.namePart2.length(); p++) {
-                    if(meta1.namePart2[p] != meta2.namePart2[p]) {
+                for(int p=0; p<meta1.name2Len && p<meta2.name2Len; p++) {
+                    if(name2R1[p] != name2R2[p]) {
                         name2DiffPos = p;
-                        name2DiffChar = meta2.namePart2[p];
+                        name2DiffChar = name2R2[p];
                         break;
                     }
                 }
             }
 
-            if(meta1.namePart2.length() < name2DiffPos)
+            if(meta1.name2Len < name2DiffPos)
                 supportInterleaved = false;
             else {
                 // there is one, and just one different char
-                if(name2DiffChar != '\0')
-                    meta1.namePart2[name2DiffPos] = name2DiffChar;
-                if(meta1.namePart2 !=  meta2.namePart2)
+                if(!name2Matches(name2R1, meta1.name2Len, name2R2, meta2.name2Len, name2DiffPos, name2DiffChar))
                     supportInterleaved = false;
             }
         }
@@ -121,7 +165,7 @@ RfqHeader* RfqCodec::makeHeader(vector<ReadPair*>& pairs) {
         header->mFlags |= BIT_ENCODE_PE_BY_OVERLAP;
     }
 
-    header->makeQualityTable(allReads, hasLaneTileXY);
+    header->makeQualityTable(batch, hasLaneTileXY);
 
     if(hasLaneTileXY) {
         header->mFlags |= BIT_HAS_LANE;
@@ -132,6 +176,8 @@ RfqHeader* RfqCodec::makeHeader(vector<ReadPair*>& pairs) {
     }
 
     header->mFlags |= BIT_PAIRED_END;
+    header->mFlags |= BIT_NAME_TOKENS;
+    header->mFlags |= BIT_NAME2_DICT;
 
     if(maxReadLen>65535)
         header->mReadLengthBytes = 4;
@@ -144,29 +190,23 @@ RfqHeader* RfqCodec::makeHeader(vector<ReadPair*>& pairs) {
     return header;
 }
 
-RfqChunk* RfqCodec::encodeChunk(vector<ReadPair*>& pairs) {
-    if(mHeader == NULL)
-        makeHeader(pairs);
-
-    if(mHeader == NULL)
-        return NULL;
-    
-    vector<Read*> reads;
-    for(int i=0; i<pairs.size(); i++) {
-        ReadPair* pair = pairs[i];
-        reads.push_back(pair->mLeft);
-        reads.push_back(pair->mRight);
-    }
-    return encodeChunk(reads, true);
+// the buffer size that any quality codec can encode len qualities in, with a little more to guarantee it's enough
+static inline uint32 qualBufBound(uint32 len) {
+    return max(max((uint32)(len * 1.5) + 1024, Rans::bound(len)), QualCM::bound(len));
 }
 
-RfqChunk* RfqCodec::encodeChunk(vector<Read*>& reads, bool isPE) {
-    int s = reads.size();
+RfqChunk* RfqCodec::encodeChunk(ReadBatch& batch) {
+    int s = batch.size();
     if(s == 0)
         return NULL;
 
     if(mHeader == NULL)
-        makeHeader(reads);
+        makeHeader(batch);
+
+    if(mHeader == NULL)
+        return NULL;
+
+    bool isPE = batch.mPaired;
 
     bool readLenSame = true;
     bool name1LenSame = true;
@@ -178,18 +218,22 @@ RfqChunk* RfqCodec::encodeChunk(vector<Read*>& reads, bool isPE) {
     bool name1Same = true;
     bool name2Same = true;
 
-    Read* r0 = reads[0];
-    FastqMeta meta0 = FastqMeta::parse(r0->mName);
+    // every name is parsed only once, and the fields are used by both passes
+    mNameFields.resize(s);
+    for(int i=0; i<s; i++)
+        FastqMeta::parse(batch.name(i), batch.nameLen(i), mNameFields[i]);
+
+    FastqNameFields& meta0 = mNameFields[0];
 
-    int readLen0 = r0->length();
-    int name1Len0 = meta0.namePart1.length();
-    int name2Len0 = meta0.namePart2.length();
-    int strandLen0 = r0->mStrand.length();
-    string strand0 = r0->mStrand;
+    int readLen0 = batch.length(0);
+    int name1Len0 = meta0.name1Len;
+    int name2Len0 = meta0.name2Len;
+    int strandLen0 = batch.strandLen(0);
+    const char* strand0 = batch.strand(0);
     uint8 lane0 = meta0.lane;
     uint16 tile0 = meta0.tile;
-    string name10 = meta0.namePart1;
-    string name20 = meta0.namePart2;
+    const char* name10 = batch.name(0);
+    const char* name20 = batch.name(0) + meta0.name2Start;
 
     uint32 totalReadLen = 0;
     uint32 totalName1Len = 0;
@@ -212,40 +256,43 @@ RfqChunk* RfqCodec::encodeChunk(vector<Read*>& reads, bool isPE) {
     bool canBePeInterleaved = isPE && mHeader->supportInterleaved();
     bool encodeOverlap = canBePeInterleaved && (mHeader->mFlags & BIT_ENCODE_PE_BY_OVERLAP);
 
-    string lastName2;
+    const char* lastName2 = NULL;
+    int lastName2Len = 0;
     uint32 lastX;
     uint32 lastY;
     uint16 lastTile;
     uint8 lastLane;
-    for(int i=0; i<reads.size(); i++) {
-        Read* r = reads[i];
-        int rlen = r->length();
-        FastqMeta meta = FastqMeta::parse(r->mName);
+    mReadLens.resize(s);
+    for(int i=0; i<s; i++) {
+        int rlen = batch.length(i);
+        int strandLen = batch.strandLen(i);
+        mReadLens[i] = rlen;
+        FastqNameFields& meta = mNameFields[i];
+        const char* name1 = batch.name(i);
+        const char* name2 = name1 + meta.name2Start;
+        bool sameName2AsFirst = name2Len0 == meta.name2Len && memcmp(name20, name2, meta.name2Len) == 0;
 
         readLenSame &= readLen0 == rlen;
-        name1LenSame &= name1Len0 == meta.namePart1.length();
-        name2LenSame &= name2Len0 == meta.namePart2.length();
-        strandLenSame &= strandLen0 == r->mStrand.length();
-        strandSame  &= strand0 == r->mStrand;
+        name1LenSame &= name1Len0 == meta.name1Len;
+        name2LenSame &= name2Len0 == meta.name2Len;
+        strandLenSame &= strandLen0 == strandLen;
+        strandSame  &= strandLen0 == strandLen && memcmp(strand0, batch.strand(i), strandLen) == 0;
         laneSame  &= lane0 == meta.lane;
         tileSame  &= tile0 == meta.tile;
-        name1Same  &= name10 == meta.namePart1;
+        name1Same  &= name1Len0 == meta.name1Len && memcmp(name10, name1, meta.name1Len) == 0;
         if(!canBePeInterleaved)
-            name2Same  &= name20 == meta.namePart2;
+            name2Same  &= sameName2AsFirst;
         else {
             // read2, check its consistent with read1
             if(i%2 == 1) {
-                string replacedName2 = lastName2;
-                // !='\0' means it has only one difference
-                if(mHeader->mName2DiffChar != '\0')
-                    replacedName2[mHeader->mName2DiffPos] = mHeader->mName2DiffChar;
-                if(replacedName2 != meta.namePart2) {
+                if(!name2Matches(lastName2, lastName2Len, name2, meta.name2Len, mHeader->mName2DiffPos, mHeader->mName2DiffChar)) {
                     canBePeInterleaved = false;
-                    name2Same  &= name20 == meta.namePart2;
+                    name2Same  &= sameName2AsFirst;
                 }
             } else {
-                lastName2 = meta.namePart2;
-                name2Same  &= name20 == meta.namePart2;
+                lastName2 = name2;
+                lastName2Len = meta.name2Len;
+                name2Same  &= sameName2AsFirst;
             }
         }
 
@@ -270,9 +317,9 @@ RfqChunk* RfqCodec::encodeChunk(vector<Read*>& reads, bool isPE) {
         }
 
         totalReadLen += rlen;
-        totalName1Len += meta.namePart1.length();
-        totalName2Len += meta.namePart2.length();
-        totalStrandLen += r->mStrand.length();
+        totalName1Len += meta.name1Len;
+        totalName2Len += meta.name2Len;
+        totalStrandLen += strandLen;
     }
 
 
@@ -329,9 +376,8 @@ RfqChunk* RfqCodec::encodeChunk(vector<Read*>& reads, bool isPE) {
     int seqCopied = 0;
     int qualCopied = 0;
 
-    for(int i=0; i<reads.size(); i++) {
-        Read* r = reads[i];
-        int rlen = r->length();
+    for(int i=0; i<s; i++) {
+        int rlen = batch.length(i);
 
         if(!readLenSame) {
             if(mHeader->mReadLengthBytes == 1)
@@ -343,17 +389,17 @@ RfqChunk* RfqCodec::encodeChunk(vector<Read*>& reads, bool isPE) {
         }
 
         if(!name1Same || !name2Same) {
-            FastqMeta meta = FastqMeta::parse(r->mName);
+            FastqNameFields& meta = mNameFields[i];
             if(!name1Same) {
-                int name1len = meta.namePart1.length();
-                memcpy(name1Buf + name1Copied, meta.namePart1.c_str(), name1len);
+                int name1len = meta.name1Len;
+                memcpy(name1Buf + name1Copied, batch.name(i), name1len);
                 name1Copied += name1len;
                 if(!name1LenSame)
                     name1LenBuf[i] = name1len;
             }
             if(!name2Same) {
-                int name2len = meta.namePart2.length();
-                memcpy(name2Buf + name2Copied, meta.namePart2.c_str(), name2len);
+                int name2len = meta.name2Len;
+                memcpy(name2Buf + name2Copied, batch.name(i) + meta.name2Start, name2len);
                 name2Copied += name2len;
                 if(!name2LenSame)
                     name2LenBuf[i] = name2len;
@@ -361,8 +407,8 @@ RfqChunk* RfqCodec::encodeChunk(vector<Read*>& reads, bool isPE) {
         }
 
         if(!strandSame) {
-            int strandlen = r->mStrand.length();
-            memcpy(strandBuf + strandCopied, r->mStrand.c_str(), strandlen);
+            int strandlen = batch.strandLen(i);
+            memcpy(strandBuf + strandCopied, batch.strand(i), strandlen);
             strandCopied += strandlen;
             if(!strandLenSame)
                 strandLenBuf[i] = strandlen;
@@ -372,9 +418,9 @@ RfqChunk* RfqCodec::encodeChunk(vector<Read*>& reads, bool isPE) {
         if(canBePeInterleaved) {
             // read2
             if(i%2 == 1) {
-                r->changeToReverseComplement();
+                batch.reverseComplement(i);
                 if(encodeOverlap){
-                    overlapped = overlap(reads[i-1]->mSeq.mStr, r->mSeq.mStr);
+                    overlapped = overlap(batch.seq(i-1), batch.length(i-1), batch.seq(i), rlen);
                     // shift it to be better fit the range [-127,127]
                     if(overlapped + mHeader->mOverlapShift > 127)
                         overlapped = 0;
@@ -385,36 +431,46 @@ RfqChunk* RfqCodec::encodeChunk(vector<Read*>& reads, bool isPE) {
             }
         }
 
+        const char* seq = batch.seq(i);
         if(overlapped == 0) {
-            memcpy(seqBufOriginal + seqCopied, r->mSeq.mStr.c_str(), rlen);
+            memcpy(seqBufOriginal + seqCopied, seq, rlen);
             seqCopied += rlen;
         } else if(overlapped > 0) {
             // forward
             // R1R1R1R1
             //     R2R2R2R2
-            memcpy(seqBufOriginal + seqCopied, r->mSeq.mStr.c_str()+overlapped, rlen - overlapped);
+            memcpy(seqBufOriginal + seqCopied, seq + overlapped, rlen - overlapped);
             seqCopied += rlen-overlapped;
         } else {
             // backward
             //     R1R1R1R1
             // R2R2R2R2
-            memcpy(seqBufOriginal + seqCopied, r->mSeq.mStr.c_str(), rlen + overlapped);
+            memcpy(seqBufOriginal + seqCopied, seq, rlen + overlapped);
             seqCopied += rlen+overlapped;
         }
 
-        memcpy(qualBufOriginal + qualCopied, r->mQuality.c_str(), rlen);
+        memcpy(qualBufOriginal + qualCopied, batch.qual(i), rlen);
         qualCopied += rlen;
     }
 
     int encodedSeqBufLen = (seqCopied + 3) / 4;
     char* seqBufEncoded = new char[encodedSeqBufLen];
     memset(seqBufEncoded, 0, encodedSeqBufLen);
-    // we allocate a little more to guarantee it's enough
-    int qualBufLen = totalReadLen * 1.5;
+    int qualBufLen = qualBufBound(totalReadLen);
     char* qualBufEncoded = new char[qualBufLen];
     memset(qualBufEncoded, 0, qualBufLen);
 
-    uint32 encodedQualBufLen = encodeSeqQual(seqBufOriginal, qualBufOriginal, seqBufEncoded, qualBufEncoded, seqCopied, qualCopied);
+    uint32 encodedQualBufLen = encodeSeqQual(seqBufOriginal, qualBufOriginal, seqBufEncoded, qualBufEncoded, seqCopied, qualCopied, canBePeInterleaved);
+
+    // code the packed sequence by the context model, its size is not known before
+    if(mHeader->mFlags & BIT_SEQ_CM) {
+        mSeqCMBuf.clear();
+        mSeqCM.encode((uint8*)seqBufEncoded, seqCopied, mSeqCMBuf);
+        delete[] seqBufEncoded;
+        encodedSeqBufLen = mSeqCMBuf.size();
+        seqBufEncoded = new char[encodedSeqBufLen];
+        memcpy(seqBufEncoded, mSeqCMBuf.data(), encodedSeqBufLen);
+    }
 
     // if we need to encode N pos, we use the same method as we encode single quality
     uint8* nPosBuf = NULL;
@@ -422,7 +478,7 @@ RfqChunk* RfqCodec::encodeChunk(vector<Read*>& reads, bool isPE) {
     if(mHeader->encodeNPos()) {
         nPosBuf = new uint8[seqCopied];
         memset(nPosBuf, 0, seqCopied);
-        nPosBufSize = encodeSingleQualByCol((uint8*)seqBufOriginal, 'N', nPosBuf, seqCopied, NULL);
+        nPosBufSize = encodeSingleQualByCol((uint8*)seqBufOriginal, 'N', nPosBuf, seqCopied);
     }
 
     delete[] seqBufOriginal;
@@ -432,10 +488,13 @@ RfqChunk* RfqCodec::encodeChunk(vector<Read*>& reads, bool isPE) {
 
     RfqChunk* chunk = new RfqChunk(mHeader);
 
-    chunk->mReads = reads.size();
+    chunk->mReads = s;
 
     if(canBePeInterleaved)
         chunk->mFlags |= BIT_PE_INTERLEAVED;
+    if(mChunkQualTable)
+        chunk->mFlags |= BIT_HAS_QUAL_TABLE;
+    chunk->mFlags |= mChunkQualCodec << QUAL_CODEC_SHIFT;
 
     if(readLenSame) chunk->mFlags |= BIT_READ_LEN_SAME;
     if(name1LenSame) chunk->mFlags |= BIT_NAME1_LEN_SAME;
@@ -538,8 +597,18 @@ RfqChunk* RfqCodec::encodeChunk(vector<Read*>& reads, bool isPE) {
 
     if(name1Same) {
         chunk->mName1Buf = new char[name1Len0];
-        memcpy(chunk->mName1Buf, name10.c_str(), name1Len0);
+        memcpy(chunk->mName1Buf, name10, name1Len0);
         chunk->mName1BufSize = name1Len0;
+    } else if(mHeader->nameTokens()) {
+        mName1Lens.resize(s);
+        for(int i=0; i<s; i++)
+            mName1Lens[i] = mNameFields[i].name1Len;
+        mName1Encoded.clear();
+        mNameTokens.encode(name1Buf, mName1Lens.data(), s, mName1Encoded);
+        delete[] name1Buf;
+        chunk->mName1Buf = new char[mName1Encoded.size()];
+        memcpy(chunk->mName1Buf, mName1Encoded.data(), mName1Encoded.size());
+        chunk->mName1BufSize = mName1Encoded.size();
     } else {
         chunk->mName1Buf = name1Buf;
         chunk->mName1BufSize = totalName1Len;
@@ -547,8 +616,18 @@ RfqChunk* RfqCodec::encodeChunk(vector<Read*>& reads, bool isPE) {
 
     if(name2Same) {
         chunk->mName2Buf = new char[name2Len0];
-        memcpy(chunk->mName2Buf, name20.c_str(), name2Len0);
+        memcpy(chunk->mName2Buf, name20, name2Len0);
         chunk->mName2BufSize = name2Len0;
+    } else if(mHeader->name2Dict()) {
+        mName2Lens.resize(s);
+        for(int i=0; i<s; i++)
+            mName2Lens[i] = mNameFields[i].name2Len;
+        mName2Encoded.clear();
+        mNameDict.encode(name2Buf, mName2Lens.data(), s, mName2Encoded);
+        delete[] name2Buf;
+        chunk->mName2Buf = new char[mName2Encoded.size()];
+        memcpy(chunk->mName2Buf, mName2Encoded.data(), mName2Encoded.size());
+        chunk->mName2BufSize = mName2Encoded.size();
     } else {
         chunk->mName2Buf = name2Buf;
         chunk->mName2BufSize = totalName2Len;
@@ -556,7 +635,7 @@ RfqChunk* RfqCodec::encodeChunk(vector<Read*>& reads, bool isPE) {
 
     if(strandSame) {
         chunk->mStrandBuf = new char[strandLen0];
-        memcpy(chunk->mStrandBuf, strand0.c_str(), strandLen0);
+        memcpy(chunk->mStrandBuf, strand0, strandLen0);
         chunk->mStrandBufSize = strandLen0;
     } else {
         chunk->mStrandBuf = strandBuf;
@@ -585,44 +664,187 @@ RfqChunk* RfqCodec::encodeChunk(vector<Read*>& reads, bool isPE) {
     return chunk;
 }
 
-uint32 RfqCodec::encodeSeqQual(char* seq, uint8* qual, char* seqEncoded, char* qualEncoded, uint32 seqLen, uint32 quaLen) {
-    // encode seq first
-    for(int i=0; i<seqLen; i++) {
-        char c = seq[i];
-        uint8 val = 0;
-        switch(c) {
-            case 'G': val=0; break;
-            case 'A': val=1; break;
-            case 'T': val=2; break;
-            case 'C': val=3; break;
-            default: break;
+uint32 RfqCodec::encodeSeqQual(char* seq, uint8* qual, char* seqEncoded, char* qualEncoded, uint32 seqLen, uint32 quaLen, bool peInterleaved) {
+    // encode seq first, 2 bits per base
+    packBases(seq, seqLen, seqEncoded);
+    mChunkQualCodec = QUAL_CODEC_HEADER;
+
+    if(mAdaptiveQual)
+        return encodeQualAdaptive(qual, quaLen, peInterleaved, qualEncoded);
+
+    // the chunks with 4 or fewer qualities can be packed in 2 bits, which decode much faster than the column coding
+    // but the planes are kept only if they are not bigger, since the column coding is nearly free for 1 or 2 qualities
+    int codec = headerQualCodec();
+    uint32 planesLen = 0;
+    if(codec == QUAL_CODEC_COL) {
+        mQualTrialBuf.resize(4 + (quaLen + 7) / 8 * 2);
+        planesLen = encodeQualPlanes(qual, quaLen, mQualTrialBuf.data());
+    }
+    uint32 qualLen = encodeQualWith(codec, qual, quaLen, mReadLens.size(), peInterleaved, qualEncoded);
+    if(planesLen > 0 && planesLen <= qualLen) {
+        memcpy(qualEncoded, mQualTrialBuf.data(), planesLen);
+        mChunkQualTable = false;
+        mChunkQualCodec = QUAL_CODEC_PLANES;
+        return planesLen;
+    }
+    return qualLen;
+}
+
+void RfqCodec::setAdaptiveQual(int trialReads) {
+    mAdaptiveQual = true;
+    mQualTrialReads = trialReads;
+}
+
+// the quality codec of the chunks without their own codec
+int RfqCodec::headerQualCodec() {
+    // the context models are chosen by the user, while rANS can also be the fallback of a large quality table
+    if(mHeader->mFlags & BIT_QUAL_CM)
+        return QUAL_CODEC_CM;
+    if(mHeader->mFlags & BIT_QUAL_RANS)
+        return QUAL_CODEC_RANS;
+    if(mHeader->mFlags & BIT_DONT_ENCODE_QUAL)
+        return QUAL_CODEC_RAW;
+    if(mHeader->mFlags & BIT_ENCODE_QUAL_BY_COL)
+        return QUAL_CODEC_COL;
+    return QUAL_CODEC_RLE;
+}
+
+// encode the qualities of the first reads, which are quaLen in total
+uint32 RfqCodec::encodeQualWith(int codec, uint8* qual, uint32 quaLen, int reads, bool peInterleaved, char* qualEncoded) {
+    mChunkQualTable = false;
+    switch(codec) {
+        case QUAL_CODEC_RAW:
+            memcpy(qualEncoded, qual, quaLen);
+            return quaLen;
+        case QUAL_CODEC_RLE:
+            return encodeQualRunLenCoding(qual, qualEncoded, quaLen);
+        case QUAL_CODEC_COL:
+            // encode qual by colum mode (such like NovaSeq data)
+            return encodeQualByCol(qual, qualEncoded, quaLen);
+        case QUAL_CODEC_RANS:
+            // entropy code the raw quality
+            mRansBuf.clear();
+            Rans::encode(qual, quaLen, 1, mRansBuf);
+            memcpy(qualEncoded, mRansBuf.data(), mRansBuf.size());
+            return mRansBuf.size();
+        case QUAL_CODEC_PLANES:
+            return encodeQualPlanes(qual, quaLen, (uint8*)qualEncoded);
+        case QUAL_CODEC_CM:
+            // context-model coding of the raw quality, the read2 of interleaved PE is reversed
+            mRansBuf.clear();
+            QualCM::encode(qual, mReadLens.data(), reads, peInterleaved, mRansBuf);
+            memcpy(qualEncoded, mRansBuf.data(), mRansBuf.size());
+            return mRansBuf.size();
+        default:
+            error_exit("unknown quality codec: " + to_string(codec));
+    }
+    return 0;
+}
+
+// the trial encodes the first mQualTrialReads reads with every codec, and the chunk is encoded by the smallest one
+// if the trial covers the whole chunk, its result is kept without encoding again
+uint32 RfqCodec::encodeQualAdaptive(uint8* qual, uint32 quaLen, bool peInterleaved, char* qualEncoded) {
+    int reads = mReadLens.size();
+    int trialReads = reads;
+    if(mQualTrialReads > 0 && mQualTrialReads < reads) {
+        trialReads = mQualTrialReads;
+        // keep the pairs of interleaved PE together
+        if(peInterleaved && trialReads % 2 == 1)
+            trialReads++;
+    }
+    uint32 trialLen = 0;
+    for(int r=0; r<trialReads; r++)
+        trialLen += mReadLens[r];
+    bool wholeChunk = trialReads == reads;
+
+    // the run length coding can only code the qualities in the header, and its bits are enough for < 64 bins
+    uint32 counts[256];
+    memset(counts, 0, sizeof(uint32)*256);
+    for(uint32 i=0; i<quaLen; i++)
+        counts[qual[i]]++;
+    bool rleUsable = mHeader->qualBins() < 64 && allQualsInHeader(counts);
+    uint8 planeSymbols[4];
+    bool planesUsable = qualPlaneSymbols(counts, planeSymbols);
+
+    mQualTrialBuf.resize(qualBufBound(trialLen));
+    int best = QUAL_CODEC_HEADER;
+    uint32 bestLen = 0;
+    bool bestQualTable = false;
+    for(int codec=QUAL_CODEC_RAW; codec<=QUAL_CODEC_PLANES; codec++) {
+        if(codec == QUAL_CODEC_RLE && !rleUsable)
+            continue;
+        if(codec == QUAL_CODEC_PLANES && !planesUsable)
+            continue;
+        uint32 len = encodeQualWith(codec, qual, trialLen, trialReads, peInterleaved, (char*)mQualTrialBuf.data());
+        if(best == QUAL_CODEC_HEADER || len < bestLen) {
+            best = codec;
+            bestLen = len;
+            bestQualTable = mChunkQualTable;
+            if(wholeChunk)
+                memcpy(qualEncoded, mQualTrialBuf.data(), len);
         }
-        int pos = i>>2;
-        int offset = i & 0x03;
-        val = val << (offset*2);
-        seqEncoded[pos] |= val;
+    }
 
-        // mask N base in quality string
-        /*if(c == 'N') {
-            qual[i] = -1;
-        }*/
+    mChunkQualCodec = best;
+    if(wholeChunk) {
+        mChunkQualTable = bestQualTable;
+        return bestLen;
     }
+    return encodeQualWith(best, qual, quaLen, reads, peInterleaved, qualEncoded);
+}
 
-    // dont encode qual
-    if(mHeader->mFlags & BIT_DONT_ENCODE_QUAL) {
-        memcpy(qualEncoded, qual, quaLen);
-        return quaLen;
+void QualColStream::reset() {
+    mBuf.clear();
+    mLast = -1;
+    mRun = 0;
+}
+
+void QualColStream::add(int pos) {
+    if(mRun > 0) {
+        // the consective run goes on
+        if(pos == mLast + 1 && mRun < 32) {
+            mRun++;
+            mLast = pos;
+            return;
+        }
+        finish();
     }
 
-    // encode qual by colum mode (such like NovaSeq data)
-    if(mHeader->mFlags & BIT_ENCODE_QUAL_BY_COL)
-        return encodeQualByCol(seq, qual, seqEncoded, qualEncoded, seqLen, quaLen);
-    else
-        return encodeQualRunLenCoding(seq, qual, seqEncoded, qualEncoded, seqLen, quaLen);
+    // a consective run starts, encoded with 110xxxxx when it ends
+    if(pos - mLast == 1 && pos > 1) {
+        mRun = 1;
+        mLast = pos;
+        return;
+    }
 
+    uint32 data = pos - mLast - 1;
+    // encoded in 1 byte:0xxxxxxx
+    if(data < 128) {
+        mBuf.push_back(data);
+    }
+    // encoded in 2 bytes: 10xxxxxx xxxxxxxx
+    else if(data < (1<<14)) {
+        mBuf.push_back((data >> 8) | 0x80);
+        mBuf.push_back(data & 0xFF);
+    }
+    // encoded in 4 bytes: 111xxxxx xxxxxxxx xxxxxxxx xxxxxxxx
+    else {
+        mBuf.push_back((data >> 24) | 0xE0);
+        mBuf.push_back((data >> 16) & 0xFF);
+        mBuf.push_back((data >> 8) & 0xFF);
+        mBuf.push_back(data & 0xFF);
+    }
+    mLast = pos;
+}
+
+void QualColStream::finish() {
+    if(mRun > 0) {
+        mBuf.push_back((mRun - 1) | 0xC0);
+        mRun = 0;
+    }
 }
 
-uint32 RfqCodec::encodeSingleQualByCol(uint8* qual, uint8 q, uint8* encoded, uint32 quaLen, bool* qualMask) {
+uint32 RfqCodec::encodeSingleQualByCol(uint8* qual, uint8 q, uint8* encoded, uint32 quaLen) {
     uint32 bufLen = 0;
     int last = -1;
     int cur = 0;
@@ -635,9 +857,6 @@ uint32 RfqCodec::encodeSingleQualByCol(uint8* qual, uint8 q, uint8* encoded, uin
                 return bufLen;
         }
 
-        if(qualMask)
-            qualMask[cur] = true;
-
         // we get a consective q
         // find the consective len
         // encoded it with 110xxxxx, where xxxxx denotes the consective len (1 ~ 32)
@@ -652,9 +871,6 @@ uint32 RfqCodec::encodeSingleQualByCol(uint8* qual, uint8 q, uint8* encoded, uin
                 else
                     break;
             }
-            // mask that this qual is normal, and is being processed
-            if(qualMask)
-                memset(qualMask + cur, true, sizeof(bool)*consectiveLen);
             // dec by another 1 to be encoded
             uint8 data = consectiveLen - 1;
             encoded[bufLen] =  data | 0xC0; //1100 0000
@@ -709,16 +925,148 @@ uint32 RfqCodec::encodeSingleQualByCol(uint8* qual, uint8 q, uint8* encoded, uin
     return bufLen;
 }
 
-uint32 RfqCodec::encodeQualByCol(char* seq, uint8* qual, char* seqEncoded, char* qualEncoded, uint32 seqLen, uint32 quaLen) {
+uint32 RfqCodec::encodeQualByCol(uint8* qual, char* qualEncoded, uint32 quaLen) {
     // encode quality
-    uint8 qualBins = mHeader->normalQualBins();
-    uint8* qualBuf = mHeader->normalQualBuf();
+    uint8* normalQuals = mHeader->normalQualBuf();
+    vector<uint8> headerBins(normalQuals, normalQuals + mHeader->normalQualBins());
+    delete[] normalQuals;
+    uint32 qualBufLen = encodeQualByColWith(qual, quaLen, mHeader->majorQual(), headerBins.data(), headerBins.size(), (uint8*)qualEncoded);
+
+    // the header's quality table is made from the first chunk, and the later chunks may differ
+    // if so, the chunk's own table is also tried, and the smaller one is kept
+    if(!makeChunkQualTable(qual, quaLen))
+        return qualBufLen;
+
+    uint8 tableLen = mChunkQuals.size();
+    mChunkQualBuf.resize(quaLen * 1.5 + 1024);
+    uint8* out = mChunkQualBuf.data();
+    out[0] = tableLen;
+    memcpy(out + 1, mChunkQuals.data(), tableLen);
+    vector<uint8> bins;
+    chunkNormalQuals(mChunkQuals.data(), tableLen, bins);
+    uint32 chunkQualBufLen = 1 + tableLen;
+    chunkQualBufLen += encodeQualByColWith(qual, quaLen, mChunkQuals[0], bins.data(), bins.size(), out + chunkQualBufLen);
+
+    if(chunkQualBufLen < qualBufLen) {
+        memcpy(qualEncoded, out, chunkQualBufLen);
+        qualBufLen = chunkQualBufLen;
+        mChunkQualTable = true;
+    }
+    return qualBufLen;
+}
 
-    uint8* qualOut = (uint8*)qualEncoded;
-    uint32 qualBufLen = 0;
+bool RfqCodec::makeChunkQualTable(uint8* qual, uint32 quaLen) {
+    uint32 counts[256];
+    memset(counts, 0, sizeof(uint32)*256);
+    for(uint32 i=0; i<quaLen; i++)
+        counts[qual[i]]++;
+
+    int major = 0;
+    int distinct = 0;
+    for(int q=0; q<256; q++) {
+        if(counts[q] > counts[major])
+            major = q;
+        if(counts[q] > 0)
+            distinct++;
+    }
+    // the column mode is used for simple quality tables only, the same as the header does
+    if(distinct == 0 || distinct > 64)
+        return false;
+
+    // the header's table works as well if it has the same major quality and all the qualities
+    if((char)major == mHeader->majorQual() && allQualsInHeader(counts))
+        return false;
+
+    mChunkQuals.clear();
+    mChunkQuals.push_back(major);
+    for(int q=0; q<256; q++) {
+        if(q != major && counts[q] > 0)
+            mChunkQuals.push_back(q);
+    }
+    return true;
+}
+
+// the 4 different symbols of the 2-bit plane coding, the counted qualities by frequency, and then unused values
+// return false if there are more than 4 qualities
+bool RfqCodec::qualPlaneSymbols(const uint32* counts, uint8* symbols) {
+    int found = 0;
+    bool used[256];
+    memset(used, 0, sizeof(bool)*256);
+    for(; found < 4; found++) {
+        int best = -1;
+        for(int q=0; q<256; q++) {
+            if(counts[q] > 0 && !used[q] && (best < 0 || counts[q] > counts[best]))
+                best = q;
+        }
+        if(best < 0)
+            break;
+        symbols[found] = best;
+        used[best] = true;
+    }
+    for(int q=0; q<256; q++) {
+        if(counts[q] > 0 && !used[q])
+            return false;
+    }
+    for(int q=0; q<256 && found < 4; q++) {
+        if(!used[q]) {
+            symbols[found++] = q;
+            used[q] = true;
+        }
+    }
+    return true;
+}
+
+// return 0 if the qualities can't be coded in 2 bits
+uint32 RfqCodec::encodeQualPlanes(uint8* qual, uint32 quaLen, uint8* qualOut) {
+    uint32 counts[256];
+    memset(counts, 0, sizeof(uint32)*256);
+    for(uint32 i=0; i<quaLen; i++)
+        counts[qual[i]]++;
+    if(!qualPlaneSymbols(counts, qualOut))
+        return 0;
+    uint32 planeLen = (quaLen + 7) / 8;
+    packQualPlanes(qual, quaLen, qualOut, qualOut + 4, qualOut + 4 + planeLen);
+    return 4 + planeLen * 2;
+}
+
+void RfqCodec::decodeQualPlanes(RfqChunk* chunk, string& qual, uint32 len) {
+    uint32 planeLen = (len + 7) / 8;
+    if(chunk->mQualBufSize != 4 + planeLen * 2)
+        error_exit("the quality length of the RFQ chunk is inconsistent, the file may be broken");
+    const uint8* symbols = chunk->mQualBuf;
+    unpackQualPlanes(symbols + 4, symbols + 4 + planeLen, len, symbols, (uint8*)&qual[0]);
+}
+
+// whether every quality counted is in the header's quality table
+bool RfqCodec::allQualsInHeader(const uint32* counts) {
+    uint8* headerQuals = mHeader->qualBuf();
+    for(int q=0; q<256; q++) {
+        if(counts[q] == 0)
+            continue;
+        bool found = false;
+        for(int i=0; i<mHeader->qualBins(); i++) {
+            if(headerQuals[i] == q) {
+                found = true;
+                break;
+            }
+        }
+        if(!found)
+            return false;
+    }
+    return true;
+}
 
-    bool* qualMask = new bool[quaLen];
-    memset(qualMask, 0, sizeof(bool)*quaLen);
+// the qualities of a chunk's table that are column encoded, the same rule as RfqHeader::normalQualBuf()
+void RfqCodec::chunkNormalQuals(const uint8* quals, uint8 tableLen, vector<uint8>& bins) {
+    bins.clear();
+    for(int i=0; i<tableLen; i++) {
+        if(quals[i] != quals[0] || (char)quals[i] == mHeader->nBaseQual())
+            bins.push_back(quals[i]);
+    }
+}
+
+uint32 RfqCodec::encodeQualByColWith(uint8* qual, uint32 quaLen, char mq, uint8* qualBuf, uint8 qualBins, uint8* qualOut) {
+    uint32 qualBufLen = 0;
 
     //qualOut[0] = qualBins;
     //qualBufLen++;
@@ -728,14 +1076,43 @@ uint32 RfqCodec::encodeQualByCol(char* seq, uint8* qual, char* seqEncoded, char*
 
     uint8* singleQualLenBuf = qualOut + qualBufLen;
 
-    uint32* singleQualLens = new uint32[qualBins];
-    memset(singleQualLens, 0, sizeof(uint32)*qualBins);
+    vector<uint32> singleQualLens(qualBins, 0);
     qualBufLen += sizeof(uint32)*qualBins;
 
-    char mq = mHeader->majorQual();
+    // the bin of each quality, or -1 if it's not a normal quality
+    int binOfQual[256];
+    for(int q=0; q<256; q++)
+        binOfQual[q] = -1;
+    for(int i=qualBins-1; i>=0; i--)
+        binOfQual[qualBuf[i]] = i;
+
+    if(mColStreams.size() < qualBins)
+        mColStreams.resize(qualBins);
+    for(int i=0; i<qualBins; i++)
+        mColStreams[i].reset();
+    mColExceptionPos.resize(256);
+    for(int q=0; q<256; q++)
+        mColExceptionPos[q].clear();
+
+    // all the bins are encoded in one pass
+    for(uint32 i=0; i<quaLen; i++) {
+        uint8 q = qual[i];
+        int bin = binOfQual[q];
+        if(bin >= 0) {
+            mColStreams[bin].add(i);
+        } else if(q != (uint8)mq) {
+            // this qual is not normal, and need special handling
+            mColExceptionPos[q].push_back(i);
+        }
+    }
 
     for(int i=0; i<qualBins; i++) {
-        singleQualLens[i] = encodeSingleQualByCol(qual, qualBuf[i], qualOut+qualBufLen, quaLen, qualMask);
+        // a quality listed twice is encoded twice
+        QualColStream& stream = mColStreams[binOfQual[qualBuf[i]]];
+        stream.finish();
+        singleQualLens[i] = stream.mBuf.size();
+        if(singleQualLens[i] > 0)
+            memcpy(qualOut + qualBufLen, stream.mBuf.data(), singleQualLens[i]);
         qualBufLen += singleQualLens[i];
     }
 
@@ -745,26 +1122,25 @@ uint32 RfqCodec::encodeQualByCol(char* seq, uint8* qual, char* seqEncoded, char*
             singleQualLens[i] = adaptToLittleEndian(singleQualLens[i]);
         }
     }
-    memcpy(singleQualLenBuf, singleQualLens, sizeof(uint32)*qualBins);
+    memcpy(singleQualLenBuf, singleQualLens.data(), sizeof(uint32)*qualBins);
 
-    for(uint32 i=0; i<quaLen; i++) {
-        // this qual is not normal, and need special handling
-        if(qualMask[i] == false && qual[i] != mq) {
-            qualOut[qualBufLen] = qual[i];
-            qualBufLen++;
-            uint32 lePos = adaptToLittleEndian(i);
-            memcpy(qualOut + qualBufLen, &lePos, sizeof(uint32));
-            qualBufLen += sizeof(uint32);
+    // the exceptions are grouped by quality: quality, count, and the position deltas, in varints
+    for(int q=0; q<256; q++) {
+        vector<uint32>& positions = mColExceptionPos[q];
+        if(positions.empty())
+            continue;
+        qualOut[qualBufLen++] = q;
+        qualBufLen += writeVarint(qualOut + qualBufLen, positions.size());
+        uint32 last = 0;
+        for(size_t p=0; p<positions.size(); p++) {
+            qualBufLen += writeVarint(qualOut + qualBufLen, positions[p] - last);
+            last = positions[p];
         }
     }
-
-    delete qualBuf;
-    delete singleQualLens;
-    delete qualMask;
     return qualBufLen;
 }
 
-uint32 RfqCodec::encodeQualRunLenCoding(char* seq, uint8* qual, char* seqEncoded, char* qualEncoded, uint32 seqLen, uint32 quaLen) {
+uint32 RfqCodec::encodeQualRunLenCoding(uint8* qual, char* qualEncoded, uint32 quaLen) {
     // encode quality
     uint32 qualBufLen = 0;
     char mq = mHeader->majorQual();
@@ -828,29 +1204,25 @@ void RfqCodec::decodeSeqQual(RfqChunk* chunk, string& seq, string& qual, uint32
         return;
     bool encodeOverlap = (chunk->mFlags & BIT_PE_INTERLEAVED) && (mHeader->mFlags & BIT_ENCODE_PE_BY_OVERLAP);
 
-    uint32 decoded = 0;
-    // decode sequence
-    for(int i=0; i<chunk->mSeqBufSize; i++) {
-        char seqEncoded = chunk->mSeqBuf[i];
-        for(int b=0; b<4; b++) {
-            char basebits = (seqEncoded & (0x03<<(b*2))) >> (b*2);
-            char base = 'N';
-            switch(basebits) {
-                case 0: base = 'G'; break;
-                case 1: base = 'A'; break;
-                case 2: base = 'T'; break;
-                case 3: base = 'C'; break;
-                default: break;
-            }
-            if(decoded < len) {
-                seq[decoded] = base;
-                decoded++;
-            } else 
-                break;
-        }
-        if(decoded >= len)
-            break;
+    // decode quality first, so the N bases can be restored by their quality while unpacking the sequence
+    decodeQual(chunk, qual, len, readLenBuf);
+    char nBaseQual = mHeader->nBaseQual();
+    bool restoreNByQual = !mHeader->encodeNPos();
+
+    // the overlapped bases of read2 are not stored, so fewer bases can be packed than len
+    const char* packed = chunk->mSeqBuf;
+    uint32 packedBases = min(len, chunk->mSeqBufSize * 4);
+    if(mHeader->mFlags & BIT_SEQ_CM) {
+        packedBases = mSeqCM.decode((uint8*)chunk->mSeqBuf, chunk->mSeqBufSize, mSeqCMBuf);
+        if(packedBases > len)
+            error_exit("the sequence length of the RFQ chunk is inconsistent, the file may be broken");
+        packed = (const char*)mSeqCMBuf.data();
+    }
+    if(restoreNByQual && !encodeOverlap) {
+        unpackBases(packed, packedBases, &seq[0], qual.data(), nBaseQual);
+        return;
     }
+    unpackBases(packed, packedBases, &seq[0], NULL, 0);
 
     // if N positions are encoded, we restore them use the same method as decoding single quality
     if(mHeader->encodeNPos()) {
@@ -896,27 +1268,53 @@ void RfqCodec::decodeSeqQual(RfqChunk* chunk, string& seq, string& qual, uint32
             }
         }
         seq = string(dstBuf, len);
-        delete dstBuf;
+        delete[] dstBuf;
         dstBuf = NULL;
     }
 
-
-    // qual is not encoded
-    if(mHeader->mFlags & BIT_DONT_ENCODE_QUAL) {
-        for(int i=0; i<chunk->mQualBufSize; i++) {
-            qual[i] = chunk->mQualBuf[i];
+    // the N bases are restored after the overlap is expanded
+    if(restoreNByQual) {
+        for (uint32 i=0; i<len; i++) {
+            if(qual[i] == nBaseQual)
+                seq[i] = 'N';
         }
-        return;
     }
+}
 
-    // encode qual by colum mode (such like NovaSeq data)
-    if(mHeader->mFlags & BIT_ENCODE_QUAL_BY_COL)
-        return decodeQualByCol(chunk, seq, qual, len);
-    else
-        return decodeQualByRunLenCoding(chunk, seq, qual, len);
+void RfqCodec::decodeQual(RfqChunk* chunk, string& qual, uint32 len, uint32* readLenBuf) {
+    int codec = (chunk->mFlags & QUAL_CODEC_MASK) >> QUAL_CODEC_SHIFT;
+    if(codec == QUAL_CODEC_HEADER)
+        codec = headerQualCodec();
+
+    switch(codec) {
+        // qual is not encoded
+        case QUAL_CODEC_RAW:
+            if(chunk->mQualBufSize != len)
+                error_exit("the quality length of the RFQ chunk is inconsistent, the file may be broken");
+            memcpy(&qual[0], chunk->mQualBuf, len);
+            return;
+        case QUAL_CODEC_RLE:
+            return decodeQualByRunLenCoding(chunk, qual, len);
+        // encode qual by colum mode (such like NovaSeq data)
+        case QUAL_CODEC_COL:
+            return decodeQualByCol(chunk, qual, len);
+        // qual is entropy coded
+        case QUAL_CODEC_RANS:
+            if(Rans::decodedLength(chunk->mQualBuf, chunk->mQualBufSize) != len)
+                error_exit("the quality length of the RFQ chunk is inconsistent, the file may be broken");
+            Rans::decode(chunk->mQualBuf, chunk->mQualBufSize, (uint8*)&qual[0], len);
+            return;
+        case QUAL_CODEC_PLANES:
+            return decodeQualPlanes(chunk, qual, len);
+        case QUAL_CODEC_CM:
+            QualCM::decode(chunk->mQualBuf, chunk->mQualBufSize, readLenBuf, chunk->mReads, chunk->mFlags & BIT_PE_INTERLEAVED, (uint8*)&qual[0], len);
+            return;
+        default:
+            error_exit("unknown quality codec of the RFQ chunk: " + to_string(codec) + ", please upgrade repaq");
+    }
 }
 
-void RfqCodec::decodeQualByRunLenCoding(RfqChunk* chunk, string& seq, string& qual, uint32 len) {
+void RfqCodec::decodeQualByRunLenCoding(RfqChunk* chunk, string& qual, uint32 len) {
     int mqNumBits = mHeader->majorQualNumBits();
     int nqNumBits = mHeader->normalQualNumBits();
     char nBaseQual = mHeader->nBaseQual();
@@ -1006,16 +1404,30 @@ void RfqCodec::decodeSingleQualByCol(uint8* buf, uint32 bufLen, uint8 q, string&
     }
 }
 
-void RfqCodec::decodeQualByCol(RfqChunk* chunk, string& seq, string& qual, uint32 len) {
+void RfqCodec::decodeQualByCol(RfqChunk* chunk, string& qual, uint32 len) {
     // decode quality
-    uint8 qualBins = mHeader->normalQualBins();
-    uint8* qualBuf = mHeader->normalQualBuf();
+    uint8* buf = chunk->mQualBuf;
+    uint32 bufLen = chunk->mQualBufSize;
+    if(chunk->mFlags & BIT_HAS_QUAL_TABLE) {
+        // the chunk's own quality table, starting with its major quality
+        uint8 tableLen = buf[0];
+        vector<uint8> bins;
+        chunkNormalQuals(buf + 1, tableLen, bins);
+        memset(&qual[0], buf[1], len);
+        decodeQualByColWith(buf + 1 + tableLen, bufLen - 1 - tableLen, bins.data(), bins.size(), qual);
+    } else {
+        uint8* normalQuals = mHeader->normalQualBuf();
+        vector<uint8> bins(normalQuals, normalQuals + mHeader->normalQualBins());
+        delete[] normalQuals;
+        decodeQualByColWith(buf, bufLen, bins.data(), bins.size(), qual);
+    }
+}
 
-    uint32 decoded = 0;
+void RfqCodec::decodeQualByColWith(uint8* buf, uint32 bufLen, uint8* qualBuf, uint8 qualBins, string& qual) {
     uint32 consumed = 0;
 
-    uint32* singleQualLens = new uint32[qualBins];
-    memcpy(singleQualLens, chunk->mQualBuf, sizeof(uint32)*qualBins);
+    vector<uint32> singleQualLens(qualBins);
+    memcpy(singleQualLens.data(), buf, sizeof(uint32)*qualBins);
     // convert from little endian if the system is big endian
     if(!isLittleEndian()) {
         for(int i=0; i<qualBins; i++) {
@@ -1024,36 +1436,94 @@ void RfqCodec::decodeQualByCol(RfqChunk* chunk, string& seq, string& qual, uint3
     }
     consumed += sizeof(uint32)*qualBins;
 
-    char mq = mHeader->majorQual();
-
     for(int i=0; i<qualBins; i++) {
-        decodeSingleQualByCol(chunk->mQualBuf + consumed, singleQualLens[i], qualBuf[i], seq, qual);
+        decodeSingleQualByCol(buf + consumed, singleQualLens[i], qualBuf[i], qual, qual);
         consumed += singleQualLens[i];
     }
 
-    while(consumed < chunk->mQualBufSize) {
-        char q = chunk->mQualBuf[consumed];
-        consumed++;
-        uint32 pos=0;
-        memcpy(&pos, chunk->mQualBuf + consumed, sizeof(uint32));
-        consumed+=sizeof(uint32);
-        //pos = adaptFromLittleEndian(pos);
-        if(pos < qual.length())
-            qual[pos] = q;
+    if(mHeader->mAlgorithmVersion >= 4) {
+        decodeQualExceptions(buf + consumed, bufLen - consumed, qual);
+    } else {
+        // before ALGORITHM_VER 4, every exception is a quality and its absolute position
+        while(consumed < bufLen) {
+            char q = buf[consumed];
+            consumed++;
+            uint32 pos=0;
+            memcpy(&pos, buf + consumed, sizeof(uint32));
+            consumed+=sizeof(uint32);
+            pos = adaptToLittleEndian(pos);
+            if(pos < qual.length())
+                qual[pos] = q;
+        }
     }
+}
 
-    delete qualBuf;
-    delete singleQualLens;
+void RfqCodec::decodeQualExceptions(const uint8* buf, uint32 bufLen, string& qual) {
+    const uint8* p = buf;
+    const uint8* end = buf + bufLen;
+    char* out = &qual[0];
+    uint32 len = qual.length();
+    while(p < end) {
+        char q = *p++;
+        uint32 count = 0;
+        p = readVarint(p, end, count);
+        uint32 pos = 0;
+        for(uint32 i=0; i<count && p<end; i++) {
+            // most deltas fit in one byte
+            if(*p < 0x80) {
+                pos += *p++;
+            } else {
+                uint32 delta = 0;
+                p = readVarint(p, end, delta);
+                pos += delta;
+            }
+            if(pos < len)
+                out[pos] = q;
+        }
+    }
+}
+
+// write an unsigned integer in decimal, and return the end
+static inline char* writeUInt(char* p, uint32 val) {
+    char digits[10];
+    int n = 0;
+    do {
+        digits[n++] = '0' + val % 10;
+        val /= 10;
+    } while(val > 0);
+    while(n > 0)
+        *p++ = digits[--n];
+    return p;
 }
 
 vector<Read*> RfqCodec::decodeChunk(RfqChunk* chunk) {
     vector<Read*> ret;
 
+    string text;
+    decodeChunk(chunk, text, NULL);
+
+    // every record has exactly 4 lines
+    size_t pos = 0;
+    string lines[4];
+    while(pos < text.length()) {
+        for(int l=0; l<4; l++) {
+            size_t end = text.find('\n', pos);
+            if(end == string::npos)
+                end = text.length();
+            lines[l] = text.substr(pos, end - pos);
+            pos = end + 1;
+        }
+        ret.push_back(new Read(lines[0], lines[1], lines[2], lines[3]));
+    }
+
+    return ret;
+}
+
+void RfqCodec::decodeChunk(RfqChunk* chunk, string& out1, string* out2) {
     if(mHeader == NULL)
-        return ret;
+        return;
 
     bool peInterleaved = chunk->mFlags & BIT_PE_INTERLEAVED;
-    bool encodeOverlap = peInterleaved && (mHeader->mFlags & BIT_ENCODE_PE_BY_OVERLAP);
 
     uint32 readLen0 = 0;
     uint16* rlenBuf16 = (uint16*)chunk->mReadLenBuf;
@@ -1066,7 +1536,8 @@ vector<Read*> RfqCodec::decodeChunk(RfqChunk* chunk) {
     }
 
     uint32 seqLen = 0;
-    uint32* readLenBuf = new uint32[chunk->mReads];
+    mReadLens.resize(chunk->mReads);
+    uint32* readLenBuf = mReadLens.data();
     if(chunk->mFlags & BIT_READ_LEN_SAME) {
         seqLen = readLen0 * chunk->mReads;
         for(int i=0; i<chunk->mReads; i++) {
@@ -1085,91 +1556,120 @@ vector<Read*> RfqCodec::decodeChunk(RfqChunk* chunk) {
         }
     }
 
-    string allSeq(seqLen, 'N');
-    string allQual(seqLen, mHeader->majorQual());
+    // the buffers are kept by this codec, so they are allocated only once
+    mAllSeq.assign(seqLen, 'N');
+    mAllQual.assign(seqLen, mHeader->majorQual());
 
-    decodeSeqQual(chunk, allSeq, allQual, seqLen, readLenBuf);
-
-    if(!mHeader->encodeNPos()) {
-        char nBaseQual = mHeader->nBaseQual();
-        for (unsigned int i=0; i<seqLen; i++) {
-            if(allQual[i] == nBaseQual) {
-                allSeq[i] = 'N';
-            }
-        }
-    }
+    // the N bases are restored here too
+    decodeSeqQual(chunk, mAllSeq, mAllQual, seqLen, readLenBuf);
 
     int name1Len0 = chunk->mName1LenBuf[0];
-    string name10(chunk->mName1Buf, name1Len0);
     int strandLen0 = chunk->mStrandLenBuf[0];
-    string strand0(chunk->mStrandBuf, strandLen0);
-
     int name2Len0 = 0;
-    string name20;
     uint8 lane0 = 0;
     uint16 tile0 = 0;
 
     uint32 xyNum = chunk->mReads;
     if(peInterleaved)
         xyNum /= 2;
-    uint32* xBuf = new uint32[xyNum];
-    uint32* yBuf = new uint32[xyNum];
-    memset(xBuf, 0, sizeof(uint32) * xyNum);
-    memset(yBuf, 0, sizeof(uint32) * xyNum);
+    mXs.assign(xyNum + 1, 0);
+    mYs.assign(xyNum + 1, 0);
     if(mHeader->hasX()) {
-        decodeCoords(chunk->mXBuf, chunk->mXBufSize, xBuf, xyNum);
+        decodeCoords(chunk->mXBuf, chunk->mXBufSize, mXs.data(), xyNum);
     }
     if(mHeader->hasY()) {
-        decodeCoords(chunk->mYBuf, chunk->mYBufSize, yBuf, xyNum);
+        decodeCoords(chunk->mYBuf, chunk->mYBufSize, mYs.data(), xyNum);
     }
 
-    char* curName1 = chunk->mName1Buf;
-    char* curName2 = chunk->mName2Buf;
-    char* curStrand = chunk->mStrandBuf;
-    uint32 curSeq = 0;
-
-    if(mHeader->hasName2()) {
+    if(mHeader->hasName2())
         name2Len0 = chunk->mName2LenBuf[0];
-        name20 = string(chunk->mName2Buf, name2Len0);
-    }
-
     if(mHeader->hasLane())
         lane0 = chunk->mLaneBuf[0];
     if(mHeader->hasTile())
         tile0 = chunk->mTileBuf[0];
 
+    bool name1Same = chunk->mFlags & BIT_NAME1_SAME;
+    bool name1LenSame = chunk->mFlags & BIT_NAME1_LEN_SAME;
+    bool name2Same = chunk->mFlags & BIT_NAME2_SAME;
+    bool name2LenSame = chunk->mFlags & BIT_NAME2_LEN_SAME;
+    bool strandSame = chunk->mFlags & BIT_STRAND_SAME;
+    bool strandLenSame = chunk->mFlags & BIT_STRAND_LEN_SAME;
+
+    // the max length of lane, tile, X and Y with their colons
+    int coordsLen = 0;
+    if(mHeader->hasLane()) coordsLen += 4;
+    if(mHeader->hasTile()) coordsLen += 6;
+    if(mHeader->hasX()) coordsLen += 11;
+    if(mHeader->hasY()) coordsLen += 11;
+
+    // reserve enough space for the text, so it can be written without checking the buffer size
+    size_t bound1 = 0;
+    size_t bound2 = 0;
     for(int r=0; r<chunk->mReads; r++) {
-        uint32 rlen = readLen0;
-        if( (chunk->mFlags & BIT_READ_LEN_SAME) == false) {
-            switch(mHeader->mReadLengthBytes) {
-                case 1: rlen = chunk->mReadLenBuf[r]; break;
-                case 2: rlen = rlenBuf16[r]; break;
-                case 4: rlen = rlenBuf32[r]; break;
-                default: error_exit("header incorrect: read length bytes should be 1/2/4");
-            }
-        }
+        size_t bound = coordsLen + readLenBuf[r] * 2 + 4;
+        bound += (name1Same || name1LenSame) ? name1Len0 : chunk->mName1LenBuf[r];
+        if(mHeader->hasName2())
+            bound += (name2Same || name2LenSame) ? name2Len0 : chunk->mName2LenBuf[r];
+        bound += (strandSame || strandLenSame) ? strandLen0 : chunk->mStrandLenBuf[r];
+        if(out2 && r%2 == 1)
+            bound2 += bound;
+        else
+            bound1 += bound;
+    }
+    size_t start1 = out1.length();
+    out1.resize(start1 + bound1);
+    char* p1 = &out1[0] + start1;
+    size_t start2 = 0;
+    char* p2 = NULL;
+    if(out2) {
+        start2 = out2->length();
+        out2->resize(start2 + bound2);
+        p2 = &(*out2)[0] + start2;
+    }
 
-        string sequence = allSeq.substr(curSeq, rlen);
-        string quality = allQual.substr(curSeq, rlen);
-        curSeq += rlen;
+    const char* curName1 = chunk->mName1Buf;
+    if(!name1Same && mHeader->nameTokens()) {
+        mName1Decoded.clear();
+        mNameTokens.decode((const uint8*)chunk->mName1Buf, chunk->mName1BufSize, chunk->mReads, mName1Decoded);
+        size_t name1Total = 0;
+        for(int r=0; r<chunk->mReads; r++)
+            name1Total += name1LenSame ? name1Len0 : chunk->mName1LenBuf[r];
+        if(mName1Decoded.length() != name1Total)
+            error_exit("the decoded names are inconsistent with the name lengths");
+        curName1 = mName1Decoded.data();
+    }
+    const char* curName2 = chunk->mName2Buf;
+    if(mHeader->hasName2() && !name2Same && mHeader->name2Dict()) {
+        mName2Decoded.clear();
+        mNameDict.decode((const uint8*)chunk->mName2Buf, chunk->mName2BufSize, chunk->mReads, mName2Decoded);
+        size_t name2Total = 0;
+        for(int r=0; r<chunk->mReads; r++)
+            name2Total += name2LenSame ? name2Len0 : chunk->mName2LenBuf[r];
+        if(mName2Decoded.length() != name2Total)
+            error_exit("the decoded name2 are inconsistent with the name2 lengths");
+        curName2 = mName2Decoded.data();
+    }
+    const char* curStrand = chunk->mStrandBuf;
+    const char* allSeq = mAllSeq.data();
+    const char* allQual = mAllQual.data();
+    uint32 curSeq = 0;
 
-        // get name;
-        stringstream ss;
-        // get name1
-        string name1;
-        if(chunk->mFlags & BIT_NAME1_SAME)
-            name1 = name10;
-        else if(chunk->mFlags & BIT_NAME1_LEN_SAME) {
-            name1 = string(curName1, name1Len0);
-            curName1 += name1Len0;
-        }
-        else {
-            int name1Len = chunk->mName1LenBuf[r];
-            name1 = string(curName1, name1Len);
+    for(int r=0; r<chunk->mReads; r++) {
+        bool isRead2 = r%2 == 1;
+        char*& p = (out2 && isRead2) ? p2 : p1;
+        uint32 rlen = readLenBuf[r];
+
+        // name1
+        int name1Len = name1Len0;
+        const char* name1 = chunk->mName1Buf;
+        if(!name1Same) {
+            if(!name1LenSame)
+                name1Len = chunk->mName1LenBuf[r];
+            name1 = curName1;
             curName1 += name1Len;
         }
-
-        ss << name1;
+        memcpy(p, name1, name1Len);
+        p += name1Len;
 
         int xyPos = r;
         if(peInterleaved)
@@ -1179,84 +1679,84 @@ vector<Read*> RfqCodec::decodeChunk(RfqChunk* chunk) {
             uint8 lane = lane0;
             if((chunk->mFlags & BIT_LANE_SAME) == false)
                 lane = chunk->mLaneBuf[xyPos];
-
-            ss << ":" << (int)lane;
+            *p++ = ':';
+            p = writeUInt(p, lane);
         }
 
         if(mHeader->hasTile()) {
             uint16 tile = tile0;
             if((chunk->mFlags & BIT_TILE_SAME) == false)
                 tile = chunk->mTileBuf[xyPos];
-
-            ss << ":" << tile;
+            *p++ = ':';
+            p = writeUInt(p, tile);
         }
 
         if(mHeader->hasX()) {
-            uint32 x = xBuf[xyPos];
-            ss << ":" << x;
+            *p++ = ':';
+            p = writeUInt(p, mXs[xyPos]);
         }
 
         if(mHeader->hasY()) {
-            uint32 y = yBuf[xyPos];
-            ss << ":" << y;
+            *p++ = ':';
+            p = writeUInt(p, mYs[xyPos]);
         }
 
         if(mHeader->hasName2()) {
-            // get name2
-            string name2;
-            if(chunk->mFlags & BIT_NAME2_SAME) {
-                name2 = name20;
-                if(peInterleaved) {
-                    // is read2
-                    if(r % 2 == 1) {
-                        // !='\0' means it has only one difference
-                        if(mHeader->mName2DiffChar != '\0')
-                            name2[mHeader->mName2DiffPos] = mHeader->mName2DiffChar;
-                    }
-                }
-            }
-            else if(chunk->mFlags & BIT_NAME2_LEN_SAME) {
-                name2 = string(curName2, name2Len0);
-                curName2 += name2Len0;
-            }
-            else {
-                int name2Len = chunk->mName2LenBuf[r];
-                name2 = string(curName2, name2Len);
+            int name2Len = name2Len0;
+            const char* name2 = chunk->mName2Buf;
+            if(!name2Same) {
+                if(!name2LenSame)
+                    name2Len = chunk->mName2LenBuf[r];
+                name2 = curName2;
                 curName2 += name2Len;
             }
-
-            ss << name2;
+            memcpy(p, name2, name2Len);
+            // !='\0' means read2 has only one difference
+            if(name2Same && peInterleaved && isRead2 && mHeader->mName2DiffChar != '\0' && mHeader->mName2DiffPos < name2Len)
+                p[mHeader->mName2DiffPos] = mHeader->mName2DiffChar;
+            p += name2Len;
         }
+        *p++ = '\n';
 
-        string name = ss.str();
+        const char* seq = allSeq + curSeq;
+        const char* qual = allQual + curSeq;
+        curSeq += rlen;
 
-        // get strand
-        string strand;
-        if(chunk->mFlags & BIT_STRAND_SAME)
-            strand = strand0;
-        else if(chunk->mFlags & BIT_STRAND_LEN_SAME) {
-            strand = string(curStrand, strandLen0);
-            curStrand += strandLen0;
+        // the read2 of interleaved PE is stored as reverse complement
+        bool reversed = peInterleaved && isRead2;
+        if(reversed) {
+            reverseComplementCopy(seq, rlen, p);
+        } else {
+            memcpy(p, seq, rlen);
         }
-        else {
-            int strandLen = chunk->mStrandLenBuf[r];
-            strand = string(curStrand, strandLen);
+        p += rlen;
+        *p++ = '\n';
+
+        // strand
+        int strandLen = strandLen0;
+        const char* strand = chunk->mStrandBuf;
+        if(!strandSame) {
+            if(!strandLenSame)
+                strandLen = chunk->mStrandLenBuf[r];
+            strand = curStrand;
             curStrand += strandLen;
         }
+        memcpy(p, strand, strandLen);
+        p += strandLen;
+        *p++ = '\n';
 
-        Read* read = new Read(name, sequence, strand, quality);
-        if(peInterleaved) {
-            // read2
-            if(r % 2 == 1)
-                read->changeToReverseComplement();
+        if(reversed) {
+            reverseCopy(qual, rlen, p);
+        } else {
+            memcpy(p, qual, rlen);
         }
-        ret.push_back(read);
+        p += rlen;
+        *p++ = '\n';
     }
 
-    delete xBuf;
-    delete yBuf;
-
-    return ret;
+    out1.resize(p1 - &out1[0]);
+    if(out2)
+        out2->resize(p2 - &(*out2)[0]);
 }
 
 uint32 RfqCodec::encodeCoords(uint32* data, uint8* buf, uint32 num) {
@@ -1388,51 +1888,190 @@ void RfqCodec::decodeCoords(uint8* buf, uint32 bufLen, uint32* data, uint32 num)
 
 }
 
-int RfqCodec::overlap(string& r1, string& r2) {
+// the shortest overlap (>= minOverlap) that the tail of text equals the head of pattern, or 0 if there is no such overlap
+// the KMP failure function of pattern is built, and text is scanned once to get the longest overlap
+// then the shorter ones are enumerated by the failure links, so it's linear to the read lengths
+int RfqCodec::shortestOverlap(const char* text, int textLen, const char* pattern, int patternLen, int minOverlap) {
+    if(patternLen == 0 || textLen == 0)
+        return 0;
+    mOverlapFail.resize(patternLen);
+    int* fail = mOverlapFail.data();
+    fail[0] = 0;
+    int k = 0;
+    for(int i=1; i<patternLen; i++) {
+        while(k > 0 && pattern[i] != pattern[k])
+            k = fail[k-1];
+        if(pattern[i] == pattern[k])
+            k++;
+        fail[i] = k;
+    }
+
+    // k is the length of the longest head of pattern that ends at the current position of text
+    k = 0;
+    for(int i=0; i<textLen; i++) {
+        while(k > 0 && (k == patternLen || text[i] != pattern[k]))
+            k = fail[k-1];
+        if(text[i] == pattern[k])
+            k++;
+    }
+
+    int shortest = 0;
+    while(k >= minOverlap) {
+        shortest = k;
+        k = fail[k-1];
+    }
+    return shortest;
+}
+
+int RfqCodec::overlap(const char* data1, int len1, const char* data2, int len2) {
     const int start = 12;
-    const int len1 = r1.length();
-    const int len2 = r2.length();
-    const int minlen = min(len1, len2);
-    const char* data1 = r1.c_str();
-    const char* data2 = r2.c_str();
     // o = overlap len
 
     // forward
     // R1R1R1R1
     //     R2R2R2R2
-    for(int o = start; o<=minlen; o++) {
-        bool overlapped = true;
-        for(int i=0; i<o; i++) {
-            if(data1[len1 - o + i] != data2[i]) {
-                overlapped = false;
-                break;
-            }
-        }
-        if(overlapped) {
-            //cerr << r1.substr(len1-o, o) << endl;
-            //cerr << r2.substr(0, o) << endl;
-            return o;
-        }
-    }
+    int o = shortestOverlap(data1, len1, data2, len2, start);
+    if(o > 0)
+        return o;
 
     // backward
     //     R1R1R1R1
     // R2R2R2R2
-    for(int o = start; o<=minlen; o++) {
-        bool overlapped = true;
-        for(int i=0; i<o; i++) {
-            if(data2[len2 - o + i] != data1[i]) {
-                overlapped = false;
-                break;
+    o = shortestOverlap(data2, len2, data1, len1, start);
+    if(o > 0)
+        return -o;
+
+    // not overlapped
+    return 0;
+}
+
+bool RfqCodec::test() {
+    RfqCodec codec;
+    string r1 = "ACGTTGCAAGGCTTAACGGATCCA";
+    // forward, the last 14 bases of r1 are the first 14 bases of r2
+    string r2 = r1.substr(10) + "TTTTGGGG";
+    if(codec.overlap(r1.c_str(), r1.length(), r2.c_str(), r2.length()) != 14)
+        return false;
+    // backward
+    if(codec.overlap(r2.c_str(), r2.length(), r1.c_str(), r1.length()) != -14)
+        return false;
+    // too short to be an overlap
+    string r3 = r1.substr(13) + "TTTTGGGG";
+    if(codec.overlap(r1.c_str(), r1.length(), r3.c_str(), r3.length()) != 0)
+        return false;
+    // periodic reads overlap in many lengths, the shortest one >= 12 is chosen
+    string p1 = "ACACACACACACACACACAC";
+    string p2 = "ACACACACACACACACACACG";
+    if(codec.overlap(p1.c_str(), p1.length(), p2.c_str(), p2.length()) != 12)
+        return false;
+    string p3 = "CACACACACACACACACACAG";
+    if(codec.overlap(p1.c_str(), p1.length(), p3.c_str(), p3.length()) != 13)
+        return false;
+
+    // the column quality coding, with the quality table of the header made from the first batch
+    // the chunks have exceptional qualities, or a different major quality which needs the chunk's own table
+    const char* headerQuals = "FFFFFFFFFFFF:::,,#55";
+    const char* exceptionQuals = "FFFFFFFFFFFF:::,,#5A";
+    const char* tableQuals = "::::::::::::FFF,,#AB";
+    const char* batchQuals[3] = {headerQuals, exceptionQuals, tableQuals};
+    RfqHeader* header = NULL;
+    for(int b=0; b<3; b++) {
+        ReadBatch batch;
+        string fastq;
+        for(int r=0; r<200; r++) {
+            string seq(100, 'A');
+            string qual(100, 'F');
+            for(int p=0; p<100; p++) {
+                // only a few exceptions in the second batch
+                int sym = (r * 31 + p * 17) % 20;
+                if(b == 1 && sym == 19 && r % 50 != 0)
+                    sym = 0;
+                qual[p] = batchQuals[b][sym];
+                seq[p] = qual[p] == '#' ? 'N' : "ACGT"[(r + p * 7) % 4];
             }
+            Read read("@A00251:28:H3YV7DSXX:4:1101:" + to_string(1000 + r) + ":2000 1:N:0:TAAGTGGC", seq, "+", qual);
+            batch.append(&read);
+            fastq += read.mName + "\n" + seq + "\n+\n" + qual + "\n";
         }
-        if(overlapped) {
-            //cerr << r1.substr(0, o) << endl;
-            //cerr << r2.substr(len2-o, o) << endl;
-            return -o;
+        if(b == 0)
+            header = codec.makeHeader(batch);
+
+        RfqChunk* chunk = codec.encodeChunk(batch);
+        bool hasTable = chunk->mFlags & BIT_HAS_QUAL_TABLE;
+        bool colCoded = (chunk->mFlags & QUAL_CODEC_MASK) == (QUAL_CODEC_HEADER << QUAL_CODEC_SHIFT) && codec.headerQualCodec() == QUAL_CODEC_COL;
+        chunk->calcTotalBufSize();
+        stringstream ss;
+        chunk->write(ss);
+        delete chunk;
+
+        RfqCodec decoder;
+        decoder.setHeader(header);
+        RfqChunk parsed(header);
+        parsed.read(ss);
+        string decoded;
+        decoder.decodeChunk(&parsed, decoded, NULL);
+        if(!colCoded || hasTable != (b == 2) || decoded != fastq) {
+            cerr << "RfqCodec::test failed with the column quality of batch " << b << endl;
+            delete header;
+            return false;
         }
     }
-
-    // not overlapped
-    return 0;
+    delete header;
+
+    // before ALGORITHM_VER 4, every exception is a quality and its absolute position in 4 bytes
+    RfqHeader legacy;
+    legacy.mAlgorithmVersion = 3;
+    codec.setHeader(&legacy);
+    string expected(40, 'F');
+    for(int p=3; p<40; p+=5)
+        expected[p] = ':';
+    uint8 buf[256];
+    uint32 colLen = codec.encodeSingleQualByCol((uint8*)&expected[0], ':', buf + 4, expected.length());
+    uint32 colLenLE = adaptToLittleEndian(colLen);
+    memcpy(buf, &colLenLE, 4);
+    uint32 bufLen = 4 + colLen;
+    uint32 exceptionPos[3] = {0, 17, 39};
+    for(int e=0; e<3; e++) {
+        expected[exceptionPos[e]] = 'A' + e;
+        buf[bufLen++] = 'A' + e;
+        uint32 pos = adaptToLittleEndian(exceptionPos[e]);
+        memcpy(buf + bufLen, &pos, 4);
+        bufLen += 4;
+    }
+    uint8 bins[1] = {':'};
+    string qual(expected.length(), 'F');
+    codec.decodeQualByColWith(buf, bufLen, bins, 1, qual);
+    if(qual != expected)
+        return false;
+
+    // the 2-bit planes of 1 to 4 qualities, for the lengths around the 16-quality vectors
+    // and a fifth quality, which can't be coded in the planes
+    const char* planeQuals = "#,:FA";
+    for(int symbols=1; symbols<=5; symbols++) {
+        for(uint32 len=0; len<=40; len++) {
+            string chunkQual(len, 'F');
+            for(uint32 i=0; i<len; i++)
+                chunkQual[i] = planeQuals[i < (uint32)symbols ? i : (i * 7 + i / 3) % symbols];
+            vector<uint8> encoded(4 + (len + 7) / 8 * 2);
+            uint32 encodedLen = codec.encodeQualPlanes((uint8*)&chunkQual[0], len, encoded.data());
+            if(symbols == 5 && len >= 5) {
+                if(encodedLen != 0)
+                    return false;
+                continue;
+            }
+            if(encodedLen != encoded.size())
+                return false;
+            RfqChunk chunk(&legacy);
+            chunk.mQualBuf = new uint8[encodedLen];
+            memcpy(chunk.mQualBuf, encoded.data(), encodedLen);
+            chunk.mQualBufSize = encodedLen;
+            string decodedQual(len, '\0');
+            codec.decodeQualPlanes(&chunk, decodedQual, len);
+            if(decodedQual != chunkQual) {
+                cerr << "RfqCodec::test failed with " << symbols << " plane qualities of length " << len << endl;
+                return false;
+            }
+        }
+    }
+    return true;
 }
\ No newline at end of file
@@ -11,35 +11,112 @@
 #include "rfqheader.h"
 #include "rfqchunk.h"
 #include "read.h"
+#include "readbatch.h"
+#include "fastqmeta.h"
+#include "seqcm.h"
+#include "nametokens.h"
 
 using namespace std;
 
+// the column-encoded positions of one quality, which can be appended position by position
+// the bytes are the same as RfqCodec::encodeSingleQualByCol() gives
+class QualColStream{
+public:
+    void reset();
+    // pos must be increasing
+    void add(int pos);
+    // end the pending consective run
+    void finish();
+
+public:
+    vector<uint8> mBuf;
+    int mLast;
+    int mRun;
+};
+
 class RfqCodec{
 public:
     RfqCodec();
     ~RfqCodec();
     void setHeader(RfqHeader* header);
-    RfqHeader* makeHeader(vector<Read*>& reads);
-    RfqHeader* makeHeader(vector<ReadPair*>& pairs);
-    RfqChunk* encodeChunk(vector<Read*>& reads, bool isPE = false);
-    RfqChunk* encodeChunk(vector<ReadPair*>& pairs);
+    // try every quality codec on the first trialReads reads (0 for all) of a chunk, and use the smallest one
+    void setAdaptiveQual(int trialReads);
+    RfqHeader* makeHeader(ReadBatch& batch);
+    RfqChunk* encodeChunk(ReadBatch& batch);
     vector<Read*> decodeChunk(RfqChunk* chunk);
+    // decode the chunk to FASTQ text appended to out1
+    // if out2 is not NULL, the read2 of paired-end reads (the odd reads) are appended to out2
+    void decodeChunk(RfqChunk* chunk, string& out1, string* out2);
+    static bool test();
 
 private:
-    uint32 encodeSeqQual(char* seq, uint8* qual, char* seqEncoded, char* qualEncoded, uint32 seqLen, uint32 quaLen);
-    uint32 encodeQualRunLenCoding(char* seq, uint8* qual, char* seqEncoded, char* qualEncoded, uint32 seqLen, uint32 quaLen);
-    uint32 encodeQualByCol(char* seq, uint8* qual, char* seqEncoded, char* qualEncoded, uint32 seqLen, uint32 quaLen);
-    uint32 encodeSingleQualByCol(uint8* qual, uint8 q, uint8* encoded, uint32 quaLen, bool* qualMask);
+    RfqHeader* makeHeaderPE(ReadBatch& batch);
+    uint32 encodeSeqQual(char* seq, uint8* qual, char* seqEncoded, char* qualEncoded, uint32 seqLen, uint32 quaLen, bool peInterleaved);
+    uint32 encodeQualWith(int codec, uint8* qual, uint32 quaLen, int reads, bool peInterleaved, char* qualEncoded);
+    uint32 encodeQualAdaptive(uint8* qual, uint32 quaLen, bool peInterleaved, char* qualEncoded);
+    int headerQualCodec();
+    bool allQualsInHeader(const uint32* counts);
+    bool qualPlaneSymbols(const uint32* counts, uint8* symbols);
+    uint32 encodeQualPlanes(uint8* qual, uint32 quaLen, uint8* qualOut);
+    uint32 encodeQualRunLenCoding(uint8* qual, char* qualEncoded, uint32 quaLen);
+    uint32 encodeQualByCol(uint8* qual, char* qualEncoded, uint32 quaLen);
+    uint32 encodeQualByColWith(uint8* qual, uint32 quaLen, char mq, uint8* qualBuf, uint8 qualBins, uint8* qualOut);
+    bool makeChunkQualTable(uint8* qual, uint32 quaLen);
+    void chunkNormalQuals(const uint8* quals, uint8 tableLen, vector<uint8>& bins);
+    uint32 encodeSingleQualByCol(uint8* qual, uint8 q, uint8* encoded, uint32 quaLen);
     uint32 encodeCoords(uint32* data, uint8* buf, uint32 num);
     void decodeSeqQual(RfqChunk* chunk, string& seq, string& qual, uint32 len, uint32* readLenBuf);
-    void decodeQualByRunLenCoding(RfqChunk* chunk, string& seq, string& qual, uint32 len);
-    void decodeQualByCol(RfqChunk* chunk, string& seq, string& qual, uint32 len);
+    void decodeQual(RfqChunk* chunk, string& qual, uint32 len, uint32* readLenBuf);
+    void decodeQualByRunLenCoding(RfqChunk* chunk, string& qual, uint32 len);
+    void decodeQualByCol(RfqChunk* chunk, string& qual, uint32 len);
+    void decodeQualPlanes(RfqChunk* chunk, string& qual, uint32 len);
+    void decodeQualByColWith(uint8* buf, uint32 bufLen, uint8* qualBuf, uint8 qualBins, string& qual);
+    void decodeQualExceptions(const uint8* buf, uint32 bufLen, string& qual);
     void decodeSingleQualByCol(uint8* buf, uint32 bufLen, uint8 q, string& seq, string& qual);
     void decodeCoords(uint8* buf, uint32 bufLen, uint32* data, uint32 num);
-    int overlap(string& r1, string& r2);
+    int overlap(const char* data1, int len1, const char* data2, int len2);
+    int shortestOverlap(const char* text, int textLen, const char* pattern, int patternLen, int minOverlap);
 
 private:
     RfqHeader* mHeader;
+    // the parsed names of the chunk being encoded, reused between chunks
+    vector<FastqNameFields> mNameFields;
+    // the read lengths of the chunk being encoded or decoded, reused between chunks
+    vector<uint32> mReadLens;
+    vector<uint32> mXs;
+    vector<uint32> mYs;
+    string mAllSeq;
+    string mAllQual;
+    // the encoding buffers of the column quality mode, reused between chunks
+    vector<QualColStream> mColStreams;
+    // the positions of the exceptional qualities, indexed by quality
+    vector<vector<uint32> > mColExceptionPos;
+    // the quality table of the chunk being encoded (the major quality first), and its trial encoding
+    vector<uint8> mChunkQuals;
+    vector<uint8> mChunkQualBuf;
+    bool mChunkQualTable;
+    // the quality codec chosen for the chunk being encoded, QUAL_CODEC_HEADER if it's not chosen by trials
+    int mChunkQualCodec;
+    bool mAdaptiveQual;
+    int mQualTrialReads;
+    vector<uint8> mQualTrialBuf;
+    // the rANS or context-model coded quality of the chunk being encoded
+    vector<uint8> mRansBuf;
+    // the context model of the sequence, and the coded (encoding) or packed (decoding) sequence of the chunk
+    SeqCM mSeqCM;
+    vector<uint8> mSeqCMBuf;
+    // the token coder of name1, with the name1 lengths (encoding) or the decoded names (decoding) of the chunk
+    NameTokens mNameTokens;
+    vector<uint32> mName1Lens;
+    vector<uint8> mName1Encoded;
+    string mName1Decoded;
+    // the dictionary coder of name2, with the name2 lengths (encoding) or the decoded names (decoding) of the chunk
+    NameDict mNameDict;
+    vector<uint32> mName2Lens;
+    vector<uint8> mName2Encoded;
+    string mName2Decoded;
+    // the KMP failure function used by overlap()
+    vector<int> mOverlapFail;
 };
 
 #endif
\ No newline at end of file
@@ -20,7 +20,7 @@ void RfqHeader::read(istream& ifs) {
     ifs.read(mRepaqFlag, 3);
     ifs.read(mRepaqVersion, 5);
     ifs.read(&mAlgorithmVersion, 1);
-    if(ALGORITHM_VER != mAlgorithmVersion) {
+    if(mAlgorithmVersion < MIN_ALGORITHM_VER || mAlgorithmVersion > ALGORITHM_VER) {
         error_exit("The data is encoded by different version of repaq, please try repaq v" + string(mRepaqVersion, 5) + ". \nSee: https://github.com/OpenGene/repaq/releases");
     }
     ifs.read((char*)&mReadLengthBytes, 1);
@@ -127,16 +127,17 @@ void RfqHeader::computeNormalQualBits() {
     else mNormalQualNumBits = 7;
 }
 
-void RfqHeader::makeQualityTable(vector<Read*>& reads, bool hasLaneTileXY) {
+void RfqHeader::makeQualityTable(ReadBatch& batch, bool hasLaneTileXY) {
     int table[128];
     memset(table, 0, sizeof(int)*128);
 
     int nBaseQualCount = 0;
-    for(int r=0; r<reads.size(); r++) {
-        Read* read = reads[r];
-        const char* seq = read->mSeq.mStr.c_str();
-        for(int i=0; i<read->length(); i++) {
-            char q = read->mQuality[i];
+    for(int r=0; r<batch.size(); r++) {
+        const char* seq = batch.seq(r);
+        const char* qual = batch.qual(r);
+        int len = batch.length(r);
+        for(int i=0; i<len; i++) {
+            char q = qual[i];
             if(q < 0) {
                 error_exit("bad quality value: " + to_string(q));
             }
@@ -155,12 +156,12 @@ void RfqHeader::makeQualityTable(vector<Read*>& reads, bool hasLaneTileXY) {
             if(base != 'A' && base != 'T' && base != 'C' && base != 'G' && base != 'N' ) {
                 if(base == 'a' || base =='t' || base == 'c' || base == 't') {
                     string errmsg("repaq doesn't support FASTQ with lowercase bases (a/t/c/g)");
-                    errmsg += "\nbut we get:\n" + read->mSeq.mStr;
+                    errmsg += "\nbut we get:\n" + string(seq, len);
                     error_exit(errmsg);
                 }
                 else {
                     string errmsg("repaq only supports FASTQ with uppercase bases (A/T/C/G/N)");
-                    errmsg += "\nbut we get:\n" + read->mSeq.mStr;
+                    errmsg += "\nbut we get:\n" + string(seq, len);
                     error_exit(errmsg);
                 }
             }
@@ -205,10 +206,11 @@ void RfqHeader::makeQualityTable(vector<Read*>& reads, bool hasLaneTileXY) {
     if(mQualBins == 0)
         error_exit("bad quality string, is this a valid FASTQ file?");
     else if(mQualBins >= 64) {
-        cerr << "WARNING: this FASTQ file's quality bins are too complicated, which may affect the compression ratio." << endl;
+        // too many bins for the column coding, the entropy coding works with any quality
+        cerr << "WARNING: this FASTQ file has " << (int)mQualBins << " quality bins, which is too many for the column coding, so they are entropy coded." << endl;
         cerr << "Please confirm this is a valid FASTQ file." << endl;
 
-        mFlags |= BIT_DONT_ENCODE_QUAL;
+        mFlags |= BIT_QUAL_RANS;
     }
 
     if(!hasN)
@@ -236,6 +238,14 @@ void RfqHeader::makeQualityTable(vector<Read*>& reads, bool hasLaneTileXY) {
     makeQualBitTable();
 }
 
+bool RfqHeader::nameTokens() {
+    return mFlags & BIT_NAME_TOKENS;
+}
+
+bool RfqHeader::name2Dict() {
+    return mFlags & BIT_NAME2_DICT;
+}
+
 bool RfqHeader::encodeNPos() {
     return mFlags & BIT_ENCODE_N_POS;
 }
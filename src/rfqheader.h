@@ -8,6 +8,7 @@
 #include "common.h"
 #include <iostream>
 #include "read.h"
+#include "readbatch.h"
 
 using namespace std;
 
@@ -40,6 +41,17 @@ using namespace std;
 #define BIT_DONT_ENCODE_QUAL (1<<8)
 // if set, the positions of N bases in the sequence will be encoded, which means the quality of N is not unique
 #define BIT_ENCODE_N_POS (1<<9)
+// if set, the raw quality is entropy coded by rANS (order 1), instead of the run length or column coding
+// it's also set when there are too many quality bins for the column coding, which were stored raw before
+#define BIT_QUAL_RANS (1<<10)
+// if set, the raw quality is coded by the adaptive context models over the cycle and the previous two qualities
+#define BIT_QUAL_CM (1<<11)
+// if set, the packed sequence is coded by the order-k context model
+#define BIT_SEQ_CM (1<<12)
+// if set, the name1 of a chunk, when it's not the same for all reads, is token coded (see nametokens.h)
+#define BIT_NAME_TOKENS (1<<13)
+// if set, the name2 of a chunk, when it's not the same for all reads, is dictionary coded (see nametokens.h)
+#define BIT_NAME2_DICT (1<<14)
 
 class RfqHeader{
 public:
@@ -51,6 +63,8 @@ public:
     bool hasX();
     bool hasY();
     bool hasName2();
+    bool nameTokens();
+    bool name2Dict();
     bool encodeNPos();
     void setEncodeNPos();
 
@@ -64,7 +78,7 @@ public:
 
     bool supportInterleaved();
 
-    void makeQualityTable(vector<Read*>& reads, bool hasLaneTileXY);
+    void makeQualityTable(ReadBatch& batch, bool hasLaneTileXY);
     void setNBaseQual(char qual);
 
     uint8 qualBins();
@@ -0,0 +1,121 @@
+#include "rfqindex.h"
+#include "endian.h"
+#include <sstream>
+#include <memory.h>
+
+#define RFQ_INDEX_MAGIC "RFQI"
+#define RFQ_INDEX_ENTRY_SIZE 24
+// <FOOTER OFFSET> and <MAGIC>
+#define RFQ_INDEX_TRAILER_SIZE 12
+
+RfqIndex::RfqIndex() {
+}
+
+void RfqIndex::addChunk(uint64 offset, uint32 reads, uint32 bases) {
+    RfqIndexEntry entry;
+    entry.offset = offset;
+    entry.firstRead = totalReads();
+    entry.reads = reads;
+    entry.bases = bases;
+    mEntries.push_back(entry);
+}
+
+uint64 RfqIndex::totalReads() {
+    if(mEntries.empty())
+        return 0;
+    RfqIndexEntry& last = mEntries.back();
+    return last.firstRead + last.reads;
+}
+
+void RfqIndex::write(ostream& ofs, uint64 footerOffset) {
+    writeLittleEndian(ofs, (uint32)0);
+    writeLittleEndian(ofs, (uint32)mEntries.size());
+    for(size_t i=0; i<mEntries.size(); i++) {
+        writeLittleEndian(ofs, mEntries[i].offset);
+        writeLittleEndian(ofs, mEntries[i].firstRead);
+        writeLittleEndian(ofs, mEntries[i].reads);
+        writeLittleEndian(ofs, mEntries[i].bases);
+    }
+    writeLittleEndian(ofs, footerOffset);
+    ofs.write(RFQ_INDEX_MAGIC, 4);
+}
+
+bool RfqIndex::read(istream& ifs) {
+    mEntries.clear();
+    streampos pos = ifs.tellg();
+
+    ifs.seekg(0, ios::end);
+    long fileSize = ifs.tellg();
+    bool found = false;
+    if(ifs.good() && fileSize >= RFQ_INDEX_TRAILER_SIZE) {
+        ifs.seekg(fileSize - RFQ_INDEX_TRAILER_SIZE);
+        uint64 footerOffset = readLittleEndian64(ifs);
+        char magic[4] = {0};
+        ifs.read(magic, 4);
+        if(ifs.good() && memcmp(magic, RFQ_INDEX_MAGIC, 4) == 0 && footerOffset + 8 <= (uint64)fileSize) {
+            ifs.seekg(footerOffset);
+            uint32 marker = readLittleEndian32(ifs);
+            uint32 num = readLittleEndian32(ifs);
+            if(marker == 0 && footerOffset + 8 + (uint64)num * RFQ_INDEX_ENTRY_SIZE + RFQ_INDEX_TRAILER_SIZE == (uint64)fileSize) {
+                for(uint32 i=0; i<num; i++) {
+                    RfqIndexEntry entry;
+                    entry.offset = readLittleEndian64(ifs);
+                    entry.firstRead = readLittleEndian64(ifs);
+                    entry.reads = readLittleEndian32(ifs);
+                    entry.bases = readLittleEndian32(ifs);
+                    mEntries.push_back(entry);
+                }
+                found = ifs.good();
+            }
+        }
+    }
+
+    if(!found)
+        mEntries.clear();
+    ifs.clear();
+    ifs.seekg(pos);
+    return found;
+}
+
+int RfqIndex::findChunk(uint64 read) {
+    // binary search the last chunk whose first read is not after the read
+    int left = 0;
+    int right = (int)mEntries.size() - 1;
+    int found = -1;
+    while(left <= right) {
+        int mid = (left + right) / 2;
+        if(mEntries[mid].firstRead <= read) {
+            found = mid;
+            left = mid + 1;
+        } else {
+            right = mid - 1;
+        }
+    }
+    if(found < 0 || read >= mEntries[found].firstRead + mEntries[found].reads)
+        return -1;
+    return found;
+}
+
+bool RfqIndex::test() {
+    RfqIndex index;
+    index.addChunk(100, 10, 1500);
+    index.addChunk(2000, 10, 1500);
+    index.addChunk(4000, 5, 750);
+
+    stringstream ss;
+    // some fake chunk data before the footer
+    ss << string(5000, 'x');
+    index.write(ss, 5000);
+
+    RfqIndex loaded;
+    if(!loaded.read(ss) || loaded.mEntries.size() != 3)
+        return false;
+    if(loaded.mEntries[2].offset != 4000 || loaded.mEntries[2].firstRead != 20 || loaded.totalReads() != 25)
+        return false;
+    if(loaded.findChunk(0) != 0 || loaded.findChunk(19) != 1 || loaded.findChunk(24) != 2 || loaded.findChunk(25) != -1)
+        return false;
+
+    stringstream noIndex;
+    noIndex << string(100, 'x');
+    return !loaded.read(noIndex);
+}
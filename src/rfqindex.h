@@ -0,0 +1,46 @@
+#ifndef RFQINDEX_H
+#define RFQINDEX_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "common.h"
+#include <iostream>
+
+using namespace std;
+
+/*
+* the optional index footer of a RFQ file, written after the last chunk since ALGORITHM_VER 3
+* <FOOTER> = <END MARKER: uint32 0><ENTRY NUM: uint32><ENTRY>...<FOOTER OFFSET: uint64><MAGIC: "RFQI">
+* <ENTRY> = <CHUNK OFFSET: uint64><FIRST READ: uint64><READS: uint32><BASES: uint32>
+* the offsets are counted from the beginning of the file, and the END MARKER is at FOOTER OFFSET
+* the reads are counted as they are stored, so a pair of paired-end reads are counted as 2
+*/
+
+struct RfqIndexEntry{
+    uint64 offset;
+    uint64 firstRead;
+    uint32 reads;
+    uint32 bases;
+};
+
+class RfqIndex{
+public:
+    RfqIndex();
+    void addChunk(uint64 offset, uint32 reads, uint32 bases);
+    // write the footer, which starts at footerOffset of the file
+    void write(ostream& ofs, uint64 footerOffset);
+    // load the footer from the end of a seekable stream, return false if there is no index
+    bool read(istream& ifs);
+    // the first chunk containing the read, or -1 if the read is out of range
+    int findChunk(uint64 read);
+    uint64 totalReads();
+
+    static bool test();
+
+public:
+    vector<RfqIndexEntry> mEntries;
+};
+
+#endif
@@ -0,0 +1,102 @@
+#include "rfqreader.h"
+#include "util.h"
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+RfqReader::RfqReader(string filename) {
+    mFilename = filename;
+    mHeader = new RfqHeader();
+    mData = NULL;
+    mDataLen = 0;
+    mPos = 0;
+    mFinished = false;
+
+    if(map()) {
+        // the header is small, parse it from a copy of the beginning
+        uint64 peek = min(mDataLen, (uint64)1024);
+        istringstream iss(string(mData, peek));
+        mHeader->read(iss);
+        mPos = iss.tellg();
+    } else {
+        mInput.open(mFilename, ios::in | ios::binary);
+        mHeader->read(mInput);
+    }
+}
+
+RfqReader::~RfqReader() {
+    unmap();
+    if(mInput.is_open())
+        mInput.close();
+    delete mHeader;
+}
+
+bool RfqReader::map() {
+    int fd = open(mFilename.c_str(), O_RDONLY);
+    if(fd < 0)
+        return false;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    void* addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(addr == MAP_FAILED)
+        return false;
+    madvise(addr, st.st_size, MADV_SEQUENTIAL);
+    mData = (const char*)addr;
+    mDataLen = st.st_size;
+    return true;
+}
+
+void RfqReader::unmap() {
+    if(mData) {
+        munmap((void*)mData, mDataLen);
+        mData = NULL;
+        mDataLen = 0;
+    }
+}
+
+bool RfqReader::isMapped() {
+    return mData != NULL;
+}
+
+RfqHeader* RfqReader::header() {
+    return mHeader;
+}
+
+RfqChunk* RfqReader::next() {
+    if(mFinished)
+        return NULL;
+
+    RfqChunk* chunk = new RfqChunk(mHeader);
+    if(isMapped()) {
+        if(mPos >= mDataLen) {
+            // the older files have no end marker
+            mFinished = true;
+            delete chunk;
+            return NULL;
+        }
+        uint64 parsed = chunk->parse(mData + mPos, mDataLen - mPos);
+        if(chunk->mReads > 0 && mHeader->mAlgorithmVersion >= 3 && parsed != chunk->mSize)
+            error_exit("the RFQ chunk size is inconsistent, the file may be broken");
+        mPos += parsed;
+    } else {
+        if(mInput.eof()) {
+            mFinished = true;
+            delete chunk;
+            return NULL;
+        }
+        chunk->read(mInput);
+    }
+
+    if(chunk->mReads == 0) {
+        mFinished = true;
+        delete chunk;
+        return NULL;
+    }
+    return chunk;
+}
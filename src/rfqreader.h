@@ -0,0 +1,47 @@
+#ifndef RFQREADER_H
+#define RFQREADER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include "common.h"
+#include <fstream>
+#include "rfqheader.h"
+#include "rfqchunk.h"
+
+using namespace std;
+
+/*
+* read the header and chunks of a RFQ file
+* a regular file is memory-mapped, and the chunks are parsed in place without copying their buffers
+* the chunks are found by their sizes since ALGORITHM_VER 3, or by parsing them for older files
+* STDIN and other files that cannot be mapped are read as a stream
+*/
+class RfqReader{
+public:
+    RfqReader(string filename);
+    ~RfqReader();
+    // the header is owned by this reader
+    RfqHeader* header();
+    // return NULL if there is no more chunk
+    // a chunk may point into the mapped file, so delete it before this reader
+    RfqChunk* next();
+    bool isMapped();
+
+private:
+    bool map();
+    void unmap();
+
+private:
+    string mFilename;
+    RfqHeader* mHeader;
+    ifstream mInput;
+    // the mapped file
+    const char* mData;
+    uint64 mDataLen;
+    // the position of next chunk in the mapped file
+    uint64 mPos;
+    bool mFinished;
+};
+
+#endif
@@ -0,0 +1,164 @@
+#include "seqcm.h"
+#include "rangecoder.h"
+#include "util.h"
+#include "simd.h"
+#include <memory.h>
+
+// the context is the previous 12 bases, hashed to a table of about one slot per base, at most 1<<22 slots
+#define SEQCM_ORDER 12
+#define SEQCM_MIN_HASH_BITS 12
+#define SEQCM_MAX_HASH_BITS 22
+#define SEQCM_METHOD_PACKED 0
+#define SEQCM_METHOD_CM 1
+// a base seen in the context adds this to its count, and the counts are halved when one exceeds the limit
+#define SEQCM_STEP 16
+#define SEQCM_COUNT_LIMIT (255 - SEQCM_STEP)
+
+static inline uint32 contextSlot(uint32 history, int hashBits) {
+    return ((history & ((1u << (SEQCM_ORDER * 2)) - 1)) * 2654435761u) >> (32 - hashBits);
+}
+
+static inline void updateCounts(uint8* counts, int base) {
+    counts[base] += SEQCM_STEP;
+    if(counts[base] > SEQCM_COUNT_LIMIT) {
+        for(int b=0; b<4; b++)
+            counts[b] >>= 1;
+    }
+}
+
+// the reads come from both strands, so a base also updates the context of its reverse complement
+// rcHistory holds the complements of the previous bases in reverse order, and the base SEQCM_ORDER bases before
+// the new one is predicted by the complements of the bases after it
+// the codes of packBases() are A:1 T:2 C:3 G:0, so the complement of a code is 3 - code
+static inline void updateReverse(uint8* table, uint32& rcHistory, int base, int hashBits) {
+    int predicted = rcHistory & 0x03;
+    rcHistory = (rcHistory >> 2) | ((uint32)(3 - base) << ((SEQCM_ORDER - 1) * 2));
+    updateCounts(table + contextSlot(rcHistory, hashBits) * 4, predicted);
+}
+
+SeqCM::SeqCM() {
+    mHashBits = SEQCM_MIN_HASH_BITS;
+}
+
+void SeqCM::resetModels(uint32 bases) {
+    mHashBits = SEQCM_MIN_HASH_BITS;
+    while(mHashBits < SEQCM_MAX_HASH_BITS && (1u << mHashBits) < bases)
+        mHashBits++;
+    mCounts.assign((size_t)4 << mHashBits, 0);
+}
+
+void SeqCM::encode(const uint8* packed, uint32 bases, vector<uint8>& out) {
+    size_t start = out.size();
+    uint32 packedLen = (bases + 3) / 4;
+    for(int b=0; b<4; b++)
+        out.push_back((bases >> (b*8)) & 0xFF);
+    out.push_back(SEQCM_METHOD_CM);
+
+    resetModels(bases);
+    RangeEncoder rc(out);
+    uint32 history = 0;
+    uint32 rcHistory = 0;
+    for(uint32 i=0; i<bases; i++) {
+        int base = (packed[i/4] >> ((i%4) * 2)) & 0x03;
+        uint8* counts = mCounts.data() + contextSlot(history, mHashBits) * 4;
+        // the frequency of a base is its count + 1, so the total is below 1<<10
+        uint32 cum = 0;
+        for(int b=0; b<base; b++)
+            cum += counts[b] + 1;
+        uint32 total = counts[0] + counts[1] + counts[2] + counts[3] + 4;
+        rc.encode(cum, counts[base] + 1, total);
+        updateCounts(counts, base);
+        history = (history << 2) | base;
+        updateReverse(mCounts.data(), rcHistory, base, mHashBits);
+    }
+    rc.finish();
+
+    // the model doesn't help, store the packed bases
+    if(out.size() - start - 5 >= packedLen) {
+        out.resize(start + 5);
+        out[start + 4] = SEQCM_METHOD_PACKED;
+        out.insert(out.end(), packed, packed + packedLen);
+    }
+}
+
+uint32 SeqCM::decode(const uint8* in, uint32 inLen, vector<uint8>& packed) {
+    if(inLen < 5)
+        error_exit("SeqCM: the encoded data is truncated");
+    uint32 bases = (uint32)in[0] | ((uint32)in[1] << 8) | ((uint32)in[2] << 16) | ((uint32)in[3] << 24);
+    int method = in[4];
+    uint32 packedLen = (bases + 3) / 4;
+    const uint8* data = in + 5;
+    uint32 dataLen = inLen - 5;
+
+    if(method == SEQCM_METHOD_PACKED) {
+        if(dataLen < packedLen)
+            error_exit("SeqCM: the encoded data is truncated");
+        packed.assign(data, data + packedLen);
+        return bases;
+    }
+    if(method != SEQCM_METHOD_CM)
+        error_exit("SeqCM: unknown coding method " + to_string(method));
+
+    resetModels(bases);
+    packed.assign(packedLen, 0);
+    RangeDecoder rc(data, dataLen);
+    uint32 history = 0;
+    uint32 rcHistory = 0;
+    for(uint32 i=0; i<bases; i++) {
+        uint8* counts = mCounts.data() + contextSlot(history, mHashBits) * 4;
+        uint32 total = counts[0] + counts[1] + counts[2] + counts[3] + 4;
+        uint32 target = rc.getFreq(total);
+        uint32 cum = 0;
+        int base = 0;
+        while(base < 3 && cum + counts[base] + 1 <= target)
+            cum += counts[base++] + 1;
+        rc.decode(cum, counts[base] + 1);
+        updateCounts(counts, base);
+        packed[i/4] |= base << ((i%4) * 2);
+        history = (history << 2) | base;
+        updateReverse(mCounts.data(), rcHistory, base, mHashBits);
+    }
+    if(rc.consumed(data) > dataLen)
+        error_exit("SeqCM: the encoded data is truncated");
+    return bases;
+}
+
+bool SeqCM::test() {
+    SeqCM cm;
+    vector<string> cases;
+    cases.push_back("");
+    cases.push_back("ACG");
+    // random bases can't be compressed, so they are stored packed
+    string random;
+    uint32 seed = 1;
+    for(int i=0; i<10000; i++) {
+        seed = seed * 1103515245 + 12345;
+        random += "ACGT"[(seed >> 16) & 0x03];
+    }
+    cases.push_back(random);
+    // reads from a short genome, which have many repeated contexts
+    string reads;
+    for(int i=0; i<200; i++)
+        reads += random.substr((i * 37) % 5000, 150);
+    cases.push_back(reads);
+
+    for(size_t c=0; c<cases.size(); c++) {
+        const string& seq = cases[c];
+        vector<uint8> packed((seq.length() + 3) / 4 + 8, 0);
+        packBases(seq.c_str(), seq.length(), (char*)packed.data());
+        packed.resize((seq.length() + 3) / 4);
+        vector<uint8> encoded;
+        cm.encode(packed.data(), seq.length(), encoded);
+        if(encoded.size() > packed.size() + 5)
+            return false;
+        // the repeated reads must be compressed well
+        if(c == 3 && encoded.size() * 2 > packed.size())
+            return false;
+        vector<uint8> decoded;
+        if(cm.decode(encoded.data(), encoded.size(), decoded) != seq.length() || decoded != packed) {
+            cerr << "SeqCM::test failed with " << seq.length() << " bases" << endl;
+            return false;
+        }
+    }
+    return true;
+}
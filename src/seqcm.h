@@ -0,0 +1,39 @@
+#ifndef SEQCM_H
+#define SEQCM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "common.h"
+
+using namespace std;
+
+/*
+* an order-k context-model coder of the 2-bit packed bases (as packBases() gives)
+* every base is range coded by the adaptive counts of the previous k bases, which are hashed to a table
+* the counts are reset for every encoded block, so the blocks can be decoded alone
+* if the model doesn't help (like low coverage data), the packed bases are stored as they are
+* the encoded data is:
+* <bases:uint32><method:uint8><packed bases, or the range coded stream>
+*/
+class SeqCM{
+public:
+    SeqCM();
+    // encode the bases, and append the encoded data to out
+    void encode(const uint8* packed, uint32 bases, vector<uint8>& out);
+    // decode the data encoded by encode() to the packed bases in packed
+    // return the number of bases
+    uint32 decode(const uint8* in, uint32 inLen, vector<uint8>& packed);
+    static bool test();
+
+private:
+    // the table is sized by the number of bases to code
+    void resetModels(uint32 bases);
+
+private:
+    // 4 counts of every hashed context
+    vector<uint8> mCounts;
+    int mHashBits;
+};
+
+#endif
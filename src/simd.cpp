@@ -0,0 +1,427 @@
+#include "simd.h"
+#include <memory.h>
+#include <string>
+#include <iostream>
+
+using namespace std;
+
+const char* findLineBreak(const char* start, const char* end) {
+    const char* p = start;
+#ifdef REPAQ_SSE2
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    while(p + 16 <= end) {
+        __m128i data = _mm_loadu_si128((const __m128i*)p);
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(data, lf), _mm_cmpeq_epi8(data, cr));
+        int mask = _mm_movemask_epi8(hit);
+        if(mask != 0)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    while(p < end) {
+        if(*p == '\n' || *p == '\r')
+            return p;
+        p++;
+    }
+    return end;
+}
+
+static inline uint8 baseCode(char c) {
+    switch(c) {
+        case 'A': return 1;
+        case 'T': return 2;
+        case 'C': return 3;
+        default: return 0;
+    }
+}
+
+void packBases(const char* seq, uint32 len, char* out) {
+    uint32 i = 0;
+#ifdef REPAQ_SSE2
+    const __m128i baseA = _mm_set1_epi8('A');
+    const __m128i baseT = _mm_set1_epi8('T');
+    const __m128i baseC = _mm_set1_epi8('C');
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i two = _mm_set1_epi8(2);
+    const __m128i lowByte = _mm_set1_epi32(0xFF);
+    while(i + 32 <= len) {
+        __m128i packed[2];
+        for(int k=0; k<2; k++) {
+            __m128i data = _mm_loadu_si128((const __m128i*)(seq + i + k*16));
+            // one code per byte, C matches both 1 and 2 to get 3
+            __m128i isC = _mm_cmpeq_epi8(data, baseC);
+            __m128i code = _mm_or_si128(
+                _mm_and_si128(_mm_or_si128(_mm_cmpeq_epi8(data, baseA), isC), one),
+                _mm_and_si128(_mm_or_si128(_mm_cmpeq_epi8(data, baseT), isC), two));
+            // gather the 4 codes of each 32-bit lane into its lowest byte
+            code = _mm_or_si128(_mm_or_si128(code, _mm_srli_epi32(code, 6)),
+                _mm_or_si128(_mm_srli_epi32(code, 12), _mm_srli_epi32(code, 18)));
+            packed[k] = _mm_and_si128(code, lowByte);
+        }
+        __m128i words = _mm_packs_epi32(packed[0], packed[1]);
+        _mm_storel_epi64((__m128i*)(out + i/4), _mm_packus_epi16(words, words));
+        i += 32;
+    }
+#endif
+    for(; i + 4 <= len; i += 4) {
+        out[i/4] = baseCode(seq[i]) | (baseCode(seq[i+1]) << 2) | (baseCode(seq[i+2]) << 4) | (baseCode(seq[i+3]) << 6);
+    }
+    if(i < len) {
+        uint8 val = 0;
+        for(int b=0; i+b < len; b++)
+            val |= baseCode(seq[i+b]) << (b*2);
+        out[i/4] = val;
+    }
+}
+
+// the 4 bases of every packed byte
+struct UnpackTable{
+    UnpackTable() {
+        const char bases[4] = {'G', 'A', 'T', 'C'};
+        for(int i=0; i<256; i++) {
+            for(int b=0; b<4; b++)
+                mBases[i][b] = bases[(i >> (b*2)) & 0x03];
+        }
+    }
+    char mBases[256][4];
+};
+
+static UnpackTable sUnpackTable;
+
+void unpackBases(const char* packed, uint32 len, char* out, const char* qual, char nQual) {
+    uint32 i = 0;
+#ifdef REPAQ_SSE2
+    // byte k of every 4 bytes holds the code of base k after masking
+    const __m128i codeMask = _mm_set1_epi32(0xC0300C03);
+    const __m128i codeA = _mm_set1_epi32(0x40100401);
+    const __m128i codeT = _mm_set1_epi32(0x80200802);
+    const __m128i baseG = _mm_set1_epi8('G');
+    const __m128i diffA = _mm_set1_epi8('A' ^ 'G');
+    const __m128i diffT = _mm_set1_epi8('T' ^ 'G');
+    const __m128i diffC = _mm_set1_epi8('C' ^ 'G');
+    const __m128i baseN = _mm_set1_epi8('N');
+    const __m128i nq = _mm_set1_epi8(nQual);
+    while(i + 32 <= len) {
+        __m128i bytes = _mm_loadl_epi64((const __m128i*)(packed + i/4));
+        bytes = _mm_unpacklo_epi8(bytes, bytes);
+        __m128i halves[2] = {_mm_unpacklo_epi16(bytes, bytes), _mm_unpackhi_epi16(bytes, bytes)};
+        for(int k=0; k<2; k++) {
+            __m128i code = _mm_and_si128(halves[k], codeMask);
+            __m128i isA = _mm_cmpeq_epi8(code, codeA);
+            __m128i isT = _mm_cmpeq_epi8(code, codeT);
+            __m128i isC = _mm_cmpeq_epi8(code, codeMask);
+            __m128i result = _mm_xor_si128(baseG, _mm_or_si128(_mm_or_si128(
+                _mm_and_si128(isA, diffA), _mm_and_si128(isT, diffT)), _mm_and_si128(isC, diffC)));
+            if(qual) {
+                __m128i isN = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(qual + i + k*16)), nq);
+                result = _mm_or_si128(_mm_andnot_si128(isN, result), _mm_and_si128(isN, baseN));
+            }
+            _mm_storeu_si128((__m128i*)(out + i + k*16), result);
+        }
+        i += 32;
+    }
+#endif
+    uint32 tail = i;
+    for(; i + 4 <= len; i += 4)
+        memcpy(out + i, sUnpackTable.mBases[(uint8)packed[i/4]], 4);
+    if(i < len)
+        memcpy(out + i, sUnpackTable.mBases[(uint8)packed[i/4]], len - i);
+    if(qual) {
+        for(uint32 j = tail; j < len; j++) {
+            if(qual[j] == nQual)
+                out[j] = 'N';
+        }
+    }
+}
+
+void packQualPlanes(const uint8* qual, uint32 len, const uint8* symbols, uint8* low, uint8* high) {
+    uint32 i = 0;
+#ifdef REPAQ_SSE2
+    const __m128i s1 = _mm_set1_epi8(symbols[1]);
+    const __m128i s2 = _mm_set1_epi8(symbols[2]);
+    const __m128i s3 = _mm_set1_epi8(symbols[3]);
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i two = _mm_set1_epi8(2);
+    const __m128i three = _mm_set1_epi8(3);
+    while(i + 16 <= len) {
+        __m128i data = _mm_loadu_si128((const __m128i*)(qual + i));
+        __m128i code = _mm_or_si128(_mm_or_si128(
+            _mm_and_si128(_mm_cmpeq_epi8(data, s1), one), _mm_and_si128(_mm_cmpeq_epi8(data, s2), two)),
+            _mm_and_si128(_mm_cmpeq_epi8(data, s3), three));
+        // move the low (or high) bit of every code to its sign bit, the bits shifted into the next byte are ignored
+        int lowBits = _mm_movemask_epi8(_mm_slli_epi16(code, 7));
+        int highBits = _mm_movemask_epi8(_mm_slli_epi16(code, 6));
+        low[i/8] = lowBits & 0xFF;
+        low[i/8 + 1] = lowBits >> 8;
+        high[i/8] = highBits & 0xFF;
+        high[i/8 + 1] = highBits >> 8;
+        i += 16;
+    }
+#endif
+    uint8 codeOf[256];
+    memset(codeOf, 0, 256);
+    for(int s=3; s>0; s--)
+        codeOf[symbols[s]] = s;
+    for(; i < len; i += 8) {
+        uint8 lowByte = 0;
+        uint8 highByte = 0;
+        for(uint32 j=0; j<8 && i+j<len; j++) {
+            uint8 code = codeOf[qual[i+j]];
+            lowByte |= (code & 0x01) << j;
+            highByte |= (code >> 1) << j;
+        }
+        low[i/8] = lowByte;
+        high[i/8] = highByte;
+    }
+}
+
+void unpackQualPlanes(const uint8* low, const uint8* high, uint32 len, const uint8* symbols, uint8* out) {
+    uint32 i = 0;
+#ifdef REPAQ_SSE2
+    const __m128i s0 = _mm_set1_epi8(symbols[0]);
+    const __m128i d1 = _mm_set1_epi8(symbols[1] ^ symbols[0]);
+    const __m128i d2 = _mm_set1_epi8(symbols[2] ^ symbols[0]);
+    const __m128i d3 = _mm_set1_epi8(symbols[3] ^ symbols[0]);
+    // byte j of the vector tests bit j%8
+    const __m128i bitOfByte = _mm_set_epi8(-128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1);
+    while(i + 16 <= len) {
+        // spread the 2 bytes of a plane to 8 bytes each, and test their bits
+        __m128i lowBits = _mm_cvtsi32_si128(low[i/8] | (low[i/8 + 1] << 8));
+        __m128i highBits = _mm_cvtsi32_si128(high[i/8] | (high[i/8 + 1] << 8));
+        lowBits = _mm_unpacklo_epi8(lowBits, lowBits);
+        highBits = _mm_unpacklo_epi8(highBits, highBits);
+        lowBits = _mm_unpacklo_epi16(lowBits, lowBits);
+        highBits = _mm_unpacklo_epi16(highBits, highBits);
+        lowBits = _mm_unpacklo_epi32(lowBits, lowBits);
+        highBits = _mm_unpacklo_epi32(highBits, highBits);
+        __m128i isLow = _mm_cmpeq_epi8(_mm_and_si128(lowBits, bitOfByte), bitOfByte);
+        __m128i isHigh = _mm_cmpeq_epi8(_mm_and_si128(highBits, bitOfByte), bitOfByte);
+        __m128i result = _mm_xor_si128(s0, _mm_or_si128(_mm_or_si128(
+            _mm_and_si128(_mm_andnot_si128(isHigh, isLow), d1),
+            _mm_and_si128(_mm_andnot_si128(isLow, isHigh), d2)),
+            _mm_and_si128(_mm_and_si128(isLow, isHigh), d3)));
+        _mm_storeu_si128((__m128i*)(out + i), result);
+        i += 16;
+    }
+#endif
+    for(; i < len; i++) {
+        int code = ((low[i/8] >> (i%8)) & 0x01) | (((high[i/8] >> (i%8)) & 0x01) << 1);
+        out[i] = symbols[code];
+    }
+}
+
+struct ComplementTable{
+    ComplementTable() {
+        memset(mBases, 'N', 256);
+        mBases['A'] = 'T';
+        mBases['a'] = 'T';
+        mBases['T'] = 'A';
+        mBases['t'] = 'A';
+        mBases['C'] = 'G';
+        mBases['c'] = 'G';
+        mBases['G'] = 'C';
+        mBases['g'] = 'C';
+    }
+    char mBases[256];
+};
+
+static const ComplementTable sComplement;
+
+char complementBase(char base) {
+    return sComplement.mBases[(uint8)base];
+}
+
+#ifdef REPAQ_SSE2
+// reverse the 16 bytes of a vector
+static inline __m128i reverseBytes(__m128i v) {
+    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+    return _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+}
+
+// the same as ComplementTable, the lower case bases are matched by setting the 0x20 bit
+static inline __m128i complementBases(__m128i v) {
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i isA = _mm_cmpeq_epi8(lower, _mm_set1_epi8('a'));
+    __m128i isT = _mm_cmpeq_epi8(lower, _mm_set1_epi8('t'));
+    __m128i isC = _mm_cmpeq_epi8(lower, _mm_set1_epi8('c'));
+    __m128i isG = _mm_cmpeq_epi8(lower, _mm_set1_epi8('g'));
+    __m128i diff = _mm_or_si128(
+        _mm_or_si128(_mm_and_si128(isA, _mm_set1_epi8('T' ^ 'N')), _mm_and_si128(isT, _mm_set1_epi8('A' ^ 'N'))),
+        _mm_or_si128(_mm_and_si128(isC, _mm_set1_epi8('G' ^ 'N')), _mm_and_si128(isG, _mm_set1_epi8('C' ^ 'N'))));
+    return _mm_xor_si128(_mm_set1_epi8('N'), diff);
+}
+#endif
+
+void reverseComplement(char* seq, char* qual, uint32 len) {
+    uint32 i = 0;
+#ifdef REPAQ_SSE2
+    // swap 16 bytes from the front with 16 bytes from the back
+    while(2 * i + 32 <= len) {
+        char* front = seq + i;
+        char* back = seq + len - 16 - i;
+        __m128i f = _mm_loadu_si128((const __m128i*)front);
+        __m128i b = _mm_loadu_si128((const __m128i*)back);
+        _mm_storeu_si128((__m128i*)front, complementBases(reverseBytes(b)));
+        _mm_storeu_si128((__m128i*)back, complementBases(reverseBytes(f)));
+        if(qual) {
+            front = qual + i;
+            back = qual + len - 16 - i;
+            f = _mm_loadu_si128((const __m128i*)front);
+            b = _mm_loadu_si128((const __m128i*)back);
+            _mm_storeu_si128((__m128i*)front, reverseBytes(b));
+            _mm_storeu_si128((__m128i*)back, reverseBytes(f));
+        }
+        i += 16;
+    }
+#endif
+    for(; 2 * i + 1 < len; i++) {
+        uint32 j = len - 1 - i;
+        char tmp = seq[i];
+        seq[i] = complementBase(seq[j]);
+        seq[j] = complementBase(tmp);
+        if(qual) {
+            tmp = qual[i];
+            qual[i] = qual[j];
+            qual[j] = tmp;
+        }
+    }
+    // the middle base of an odd length
+    if(2 * i + 1 == len)
+        seq[i] = complementBase(seq[i]);
+}
+
+void reverseComplementCopy(const char* seq, uint32 len, char* out) {
+    uint32 i = 0;
+#ifdef REPAQ_SSE2
+    for(; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(seq + len - 16 - i));
+        _mm_storeu_si128((__m128i*)(out + i), complementBases(reverseBytes(v)));
+    }
+#endif
+    for(; i < len; i++)
+        out[i] = complementBase(seq[len - 1 - i]);
+}
+
+void reverseCopy(const char* data, uint32 len, char* out) {
+    uint32 i = 0;
+#ifdef REPAQ_SSE2
+    for(; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + len - 16 - i));
+        _mm_storeu_si128((__m128i*)(out + i), reverseBytes(v));
+    }
+#endif
+    for(; i < len; i++)
+        out[i] = data[len - 1 - i];
+}
+
+bool simdTest() {
+    const char* letters = "ACGTNacgtnRY-.*";
+    const uint32 maxLen = 300;
+    // a guard byte after every output, which must not be written
+    const char guard = 0x5A;
+    uint32 seed = 7;
+    for(uint32 len=0; len<=maxLen; len++) {
+        string seq(len, 'A');
+        string acgtn(len, 'A');
+        string qual(len, 'F');
+        for(uint32 i=0; i<len; i++) {
+            seed = seed * 1103515245 + 12345;
+            seq[i] = letters[(seed >> 16) % 15];
+            acgtn[i] = "ACGTN"[(seed >> 8) % 5];
+            qual[i] = acgtn[i] == 'N' ? '#' : 'F' - (seed >> 24) % 8;
+        }
+
+        // packBases with mixed case, N and other characters, which are all coded as G
+        uint32 packedLen = (len + 3) / 4;
+        string packed(packedLen + 1, guard);
+        packBases(seq.data(), len, &packed[0]);
+        string expected(packedLen, '\0');
+        for(uint32 i=0; i<len; i++)
+            expected[i/4] |= baseCode(seq[i]) << ((i%4) * 2);
+        if(packed.substr(0, packedLen) != expected || packed[packedLen] != guard) {
+            cerr << "packBases failed with " << len << " bases" << endl;
+            return false;
+        }
+
+        // unpackBases restores N by the quality, or gives G without the quality
+        packBases(acgtn.data(), len, &packed[0]);
+        string unpacked(len + 1, guard);
+        unpackBases(packed.data(), len, &unpacked[0], qual.data(), '#');
+        if(unpacked.substr(0, len) != acgtn || unpacked[len] != guard) {
+            cerr << "unpackBases failed with " << len << " bases" << endl;
+            return false;
+        }
+        unpackBases(packed.data(), len, &unpacked[0], NULL, '#');
+        for(uint32 i=0; i<len; i++) {
+            if(unpacked[i] != (acgtn[i] == 'N' ? 'G' : acgtn[i])) {
+                cerr << "unpackBases failed without quality with " << len << " bases" << endl;
+                return false;
+            }
+        }
+
+        // the reverse complement kernels against a plain loop
+        string rc(len, 'N');
+        string reversed(len, 'F');
+        for(uint32 i=0; i<len; i++) {
+            rc[i] = complementBase(seq[len - 1 - i]);
+            reversed[i] = qual[len - 1 - i];
+        }
+        string s1 = seq;
+        string q1 = qual;
+        reverseComplement(&s1[0], &q1[0], len);
+        string s2 = seq;
+        reverseComplement(&s2[0], NULL, len);
+        if(s1 != rc || q1 != reversed || s2 != rc) {
+            cerr << "reverseComplement failed with " << len << " bases" << endl;
+            return false;
+        }
+        string copied(len + 1, guard);
+        reverseComplementCopy(seq.data(), len, &copied[0]);
+        if(copied.substr(0, len) != rc || copied[len] != guard) {
+            cerr << "reverseComplementCopy failed with " << len << " bases" << endl;
+            return false;
+        }
+        reverseCopy(qual.data(), len, &copied[0]);
+        if(copied.substr(0, len) != reversed || copied[len] != guard) {
+            cerr << "reverseCopy failed with " << len << " bases" << endl;
+            return false;
+        }
+
+        // the quality planes, with some qualities not in the symbols, which are coded as symbols[0]
+        const uint8 symbols[4] = {'F', ':', ',', '#'};
+        const char* quals = "F:,#F:FA";
+        uint32 planeLen = (len + 7) / 8;
+        string low(planeLen + 1, guard);
+        string high(planeLen + 1, guard);
+        for(uint32 i=0; i<len; i++)
+            qual[i] = quals[(uint8)seq[i] % 8];
+        packQualPlanes((const uint8*)qual.data(), len, symbols, (uint8*)&low[0], (uint8*)&high[0]);
+        string expectedLow(planeLen, '\0');
+        string expectedHigh(planeLen, '\0');
+        string restored(len, 'F');
+        for(uint32 i=0; i<len; i++) {
+            int code = 0;
+            while(code < 4 && symbols[code] != (uint8)qual[i])
+                code++;
+            code %= 4;
+            expectedLow[i/8] |= (code & 0x01) << (i%8);
+            expectedHigh[i/8] |= (code >> 1) << (i%8);
+            restored[i] = symbols[code];
+        }
+        if(low.substr(0, planeLen) != expectedLow || high.substr(0, planeLen) != expectedHigh
+            || low[planeLen] != guard || high[planeLen] != guard) {
+            cerr << "packQualPlanes failed with " << len << " qualities" << endl;
+            return false;
+        }
+        string unpackedQual(len + 1, guard);
+        unpackQualPlanes((const uint8*)low.data(), (const uint8*)high.data(), len, symbols, (uint8*)&unpackedQual[0]);
+        if(unpackedQual.substr(0, len) != restored || unpackedQual[len] != guard) {
+            cerr << "unpackQualPlanes failed with " << len << " qualities" << endl;
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,52 @@
+#ifndef REPAQ_SIMD_H
+#define REPAQ_SIMD_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "common.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define REPAQ_SSE2 1
+#endif
+
+/*
+* vectorized kernels for the hot loops
+* every kernel has a scalar fallback, and gives exactly the same result as the fallback
+*/
+
+// return the position of the first '\r' or '\n' in [start, end), or end if there is no line break
+const char* findLineBreak(const char* start, const char* end);
+
+// pack the bases to 2-bit codes, 4 bases per byte from the lowest bits, G=0, A=1, T=2, C=3, and other bases are 0
+// (len + 3) / 4 bytes are written to out
+void packBases(const char* seq, uint32 len, char* out);
+
+// unpack len bases packed by packBases() to out
+// if qual is not NULL, the bases with quality nQual are restored to N
+void unpackBases(const char* packed, uint32 len, char* out, const char* qual, char nQual);
+
+// pack the qualities to 2 bit planes, the 2-bit code of a quality is its index in the 4 symbols, which must be different
+// bit j of byte k in a plane is the low (or high) bit of the code of quality 8k+j, and the qualities not in symbols get 0
+// (len + 7) / 8 bytes are written to low and high
+void packQualPlanes(const uint8* qual, uint32 len, const uint8* symbols, uint8* low, uint8* high);
+
+// unpack len qualities packed by packQualPlanes() to out
+void unpackQualPlanes(const uint8* low, const uint8* high, uint32 len, const uint8* symbols, uint8* out);
+
+// complement of a base, A/T/C/G in either case are complemented to upper case, and others to N
+char complementBase(char base);
+
+// reverse complement the sequence in place, and reverse the quality together if qual is not NULL
+void reverseComplement(char* seq, char* qual, uint32 len);
+
+// write the reverse complement of seq to out, which must not overlap seq
+void reverseComplementCopy(const char* seq, uint32 len, char* out);
+
+// write the reverse of data to out, which must not overlap data
+void reverseCopy(const char* data, uint32 len, char* out);
+
+// check the kernels against plain loops for every length up to a few vectors
+bool simdTest();
+
+#endif
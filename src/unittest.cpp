@@ -1,6 +1,15 @@
 #include "unittest.h"
 #include <time.h>
 #include "fastqmeta.h"
+#include "fastqreader.h"
+#include "readbatch.h"
+#include "rfqindex.h"
+#include "rfqcodec.h"
+#include "rans.h"
+#include "qualcm.h"
+#include "seqcm.h"
+#include "nametokens.h"
+#include "simd.h"
 
 UnitTest::UnitTest(){
 
@@ -9,6 +18,16 @@ UnitTest::UnitTest(){
 void UnitTest::run(){
     bool passed = true;
     passed &= FastqMeta::test();
+    passed &= report(FastqReader::test(), "FastqReader::test");
+    passed &= report(simdTest(), "simdTest");
+    passed &= report(ReadBatch::test(), "ReadBatch::test");
+    passed &= report(RfqIndex::test(), "RfqIndex::test");
+    passed &= report(RfqCodec::test(), "RfqCodec::test");
+    passed &= report(Rans::test(), "Rans::test");
+    passed &= report(QualCM::test(), "QualCM::test");
+    passed &= report(SeqCM::test(), "SeqCM::test");
+    passed &= report(NameTokens::test(), "NameTokens::test");
+    passed &= report(NameDict::test(), "NameDict::test");
     printf("\n==========================\n");
     printf("%s\n\n", passed?"ALL PASSED":"FAILED");
 }